@@ -24,7 +24,7 @@
 
 #include <stdarg.h>
 
-static void akl_ir_exec_branch(struct akl_context *, struct akl_list_entry *);
+static void akl_ir_exec_branch(struct akl_context *, unsigned int);
 
 static void update_recent_value(struct akl_state *s, struct akl_value *val)
 {
@@ -35,14 +35,19 @@ static void update_recent_value(struct akl_state *s, struct akl_value *val)
         AKL_GC_SET_STATIC(recent_var);
     }
     /* Update '$?' with the recently used value */
+    AKL_GC_WRITE_BARRIER(s, recent_var);
     recent_var->vr_value = val;
+    recent_var->vr_version++;
 }
 
 /* ~~~===### Stack handling ###===~~~ */
+/* The stack is an array of value pointers */
+#define STACK_AT(stack, ind) (((struct akl_value **)(stack)->av_vector)[ind])
+
 unsigned int akl_frame_get_count(struct akl_context *ctx)
 {
     assert(ctx);
-    return akl_list_count(ctx->cx_frame);
+    return ctx->cx_frame.fr_count;
 }
 
 bool_t akl_frame_is_empty(struct akl_context *ctx)
@@ -53,7 +58,10 @@ bool_t akl_frame_is_empty(struct akl_context *ctx)
 
 struct akl_value *akl_frame_at(struct akl_context *ctx, unsigned int ind)
 {
-    return akl_list_index_value(ctx->cx_frame, ind);
+    struct akl_frame *fr = &ctx->cx_frame;
+    if (ind >= fr->fr_count)
+        return NULL;
+    return STACK_AT(ctx->cx_stack, fr->fr_base + ind);
 }
 
 unsigned int akl_frame_get_pointer(struct akl_context *ctx)
@@ -63,28 +71,24 @@ unsigned int akl_frame_get_pointer(struct akl_context *ctx)
 
 void akl_stack_clear(struct akl_context *ctx, size_t c)
 {
-#if 0
-    void *ptr;
-    do {
-        ptr = akl_frame_pop(ctx);
-    } while (c-- || ptr != NULL);
-#endif 
-    //akl_vector_truncate_by(ctx->cx_stack, c);
     // TODO: Evaulate GC on this
-    akl_init_list(ctx->cx_stack);
+    ctx->cx_stack->av_count = 0;
 }
 
+/* Remove the frame (and everything above it) from the stack */
 void akl_frame_destroy(struct akl_context *cx, int argc)
 {
-    while (akl_frame_pop(cx))
-        ;
+    struct akl_frame *fr = &cx->cx_frame;
+    if (akl_vector_count(cx->cx_stack) > fr->fr_bottom)
+        cx->cx_stack->av_count = fr->fr_bottom;
+    fr->fr_base = fr->fr_bottom;
+    fr->fr_count = 0;
 }
 
-/* Attention: The stack contains pointer to value pointers */
 void akl_stack_push(struct akl_context *ctx, struct akl_value *value)
 {
     AKL_ASSERT(ctx && value, AKL_NOTHING);
-    akl_list_append_value(ctx->cx_state, ctx->cx_stack, value);
+    akl_vector_push(ctx->cx_stack, &value);
 }
 
 void akl_frame_push(struct akl_context *ctx, struct akl_value *value)
@@ -94,69 +98,80 @@ void akl_frame_push(struct akl_context *ctx, struct akl_value *value)
     /* TODO */
 }
 
+/* Shifting and popping only shrink the frame, the arguments
+   stay in the stack until akl_frame_destroy() */
 struct akl_value *akl_frame_shift(struct akl_context *ctx)
 {
-    struct akl_list_entry *ent;
+    struct akl_frame *fr;
     if (ctx == NULL || akl_frame_get_count(ctx) == 0)
         return NULL;
 
-    ent = akl_list_shift_entry(ctx->cx_frame);
-    akl_list_remove_entry(ctx->cx_stack, ent);
-    return AKL_ENTRY_VALUE(ent);
+    fr = &ctx->cx_frame;
+    fr->fr_count--;
+    return STACK_AT(ctx->cx_stack, fr->fr_base++);
 }
 
 struct akl_value *akl_frame_head(struct akl_context *ctx)
 {
     if (ctx == NULL)
         return NULL;
-    return akl_list_head(ctx->cx_frame);
+    return akl_frame_at(ctx, 0);
 }
 
 struct akl_value *akl_frame_pop(struct akl_context *ctx)
 {
-    struct akl_list_entry *ent;
+    struct akl_frame *fr;
     if (ctx == NULL || ctx->cx_state == NULL || akl_frame_get_count(ctx) == 0)
         return NULL;
 
-    ent = akl_list_pop_entry(ctx->cx_frame);
-    akl_list_remove_entry(ctx->cx_stack, ent);
-    return AKL_ENTRY_VALUE(ent);
+    fr = &ctx->cx_frame;
+    return STACK_AT(ctx->cx_stack, fr->fr_base + --fr->fr_count);
 }
 
 struct akl_value *akl_stack_head(struct akl_state *s)
 {
     AKL_ASSERT(s, NULL);
-    return akl_list_head(&s->ai_stack);
+    if (akl_vector_is_empty(&s->ai_stack))
+        return NULL;
+    return STACK_AT(&s->ai_stack, 0);
 }
 
 struct akl_value *akl_stack_top(struct akl_context *ctx)
 {
     AKL_ASSERT(ctx && ctx->cx_state, NULL);
-    return akl_list_last(ctx->cx_stack);
+    if (akl_vector_is_empty(ctx->cx_stack))
+        return NULL;
+    return STACK_AT(ctx->cx_stack, akl_vector_count(ctx->cx_stack)-1);
 }
 
 struct akl_value *akl_stack_pop(struct akl_context *ctx)
 {
-
-    struct akl_value *v = (struct akl_value *)akl_list_pop(ctx->cx_stack);
-    if (v == NULL && ctx->cx_parent != NULL) {
-        v = (struct akl_value *)akl_list_pop(ctx->cx_parent->cx_stack);
+    struct akl_vector *stack = ctx->cx_stack;
+    if (akl_vector_is_empty(stack) && ctx->cx_parent != NULL) {
+        stack = ctx->cx_parent->cx_stack;
     }
-    return v;
+    if (akl_vector_is_empty(stack))
+        return NULL;
+    return STACK_AT(stack, --stack->av_count);
 }
 
 struct akl_value *
 akl_frame_top(struct akl_context *ctx)
 {
     AKL_ASSERT(ctx, NULL);
-    return (struct akl_value *)akl_list_last(ctx->cx_frame);
+    if (akl_frame_get_count(ctx) == 0)
+        return NULL;
+    return akl_frame_at(ctx, ctx->cx_frame.fr_count-1);
 }
 
 /* These functions do not check the type of the stack top */
 double *akl_frame_pop_number(struct akl_context *ctx)
 {
     struct akl_value *v = akl_frame_pop(ctx);
-    if (AKL_CHECK_TYPE(v, AKL_VT_NUMBER)) {
+    if (AKL_IS_IMMEDIATE(v)) {
+        ctx->cx_number = akl_immediate_to_number(v);
+        return &ctx->cx_number;
+    } else if (AKL_CHECK_TYPE(v, AKL_VT_NUMBER)) {
         return &v->va_value.number;
     }
     return NULL;
@@ -165,7 +180,10 @@ double *akl_frame_pop_number(struct akl_context *ctx)
 double *akl_frame_shift_number(struct akl_context *ctx)
 {
     struct akl_value *v = akl_frame_shift(ctx);
-    if (AKL_CHECK_TYPE(v, AKL_VT_NUMBER)) {
+    if (AKL_IS_IMMEDIATE(v)) {
+        ctx->cx_number = akl_immediate_to_number(v);
+        return &ctx->cx_number;
+    } else if (AKL_CHECK_TYPE(v, AKL_VT_NUMBER)) {
         return &v->va_value.number;
     }
     return NULL;
@@ -200,7 +218,7 @@ akl_frame_shift_list(struct akl_context *ctx)
 enum AKL_VALUE_TYPE akl_stack_top_type(struct akl_context *ctx)
 {
     struct akl_value *v = akl_frame_pop(ctx);
-    return (v) ? v->va_type : AKL_VT_NIL;
+    return (v) ? AKL_TYPE(v) : AKL_VT_NIL;
 }
 
 int akl_get_args(struct akl_context *ctx, int argc, ...)
@@ -263,15 +281,15 @@ int akl_get_args_strict(struct akl_context *ctx, int argc, ...)
         }
         /* The expected type must be the same with the current type,
             unless if that is a nil or a true or a pseudotype like AKL_VT_ANY */
-        if ((t > AKL_VT_TRUE) && t != vp->va_type) {
+        if ((t > AKL_VT_TRUE) && t != AKL_TYPE(vp)) {
             /* If the next argument is optional, skip it and don't complain */
             if (arg_opt) {
                 val = va_arg(ap, struct akl_value **);
                 arg_opt = FALSE;
             } else {
-                ctx->cx_lex_info = vp->va_lex_info;
+                ctx->cx_lex_info = AKL_LEX_INFO(vp);
                 akl_raise_error(ctx, AKL_ERROR, "%s: Expected %s but got %s"
-                    , ctx->cx_func_name, akl_type_name[t], akl_type_name[vp->va_type]);
+                    , ctx->cx_func_name, akl_type_name[t], akl_type_name[AKL_TYPE(vp)]);
             }
             return -1;
         }
@@ -345,19 +363,17 @@ int akl_get_args_strict(struct akl_context *ctx, int argc, ...)
 }
 
 
+/* The contexts of the called functions (activation records) are
+   taken from the preallocated call stack of the state, in LIFO order.
+   Every bound context must be given back with akl_release_context(). */
 struct akl_context *
 akl_bound_function(struct akl_context *ctx, struct akl_symbol *sym
                    , struct akl_function *fn)
 {
-    struct akl_context *cx = akl_new_context(ctx->cx_state);
+    struct akl_state *s = ctx->cx_state;
+    struct akl_context *cx;
     struct akl_variable *v;
 
-    if (cx == NULL) {
-        akl_raise_error(ctx, AKL_ERROR, "Cannot create context");
-        return NULL;
-    }
-
-    *(cx) = *(ctx);
     if (fn == NULL) {
         if (sym == NULL) {
             akl_raise_error(ctx, AKL_ERROR, "Interpreter error: Function and symbol can't be NULL at the same time.");
@@ -375,6 +391,14 @@ akl_bound_function(struct akl_context *ctx, struct akl_symbol *sym
         }
         fn = akl_var_to_function(v);
     }
+
+    if (s->ai_call_depth >= AKL_CALL_STACK_SIZE) {
+        akl_raise_error(ctx, AKL_ERROR, "Stack overflow (more than %d nested calls)"
+                        , AKL_CALL_STACK_SIZE);
+        return NULL;
+    }
+    cx = &s->ai_call_stack[s->ai_call_depth++];
+    *(cx) = *(ctx);
     cx->cx_func = fn;
     if (sym == NULL) {
         cx->cx_func_name = "lambda";
@@ -385,6 +409,45 @@ akl_bound_function(struct akl_context *ctx, struct akl_symbol *sym
     return cx;
 }
 
+/* Give back the context (and every context above it) to the call stack */
+void akl_release_context(struct akl_context *cx)
+{
+    struct akl_state *s;
+    if (cx == NULL || cx->cx_state == NULL)
+        return;
+
+    s = cx->cx_state;
+    if (cx >= s->ai_call_stack && cx < s->ai_call_stack + s->ai_call_depth)
+        s->ai_call_depth = cx - s->ai_call_stack;
+}
+
+/* The value returned by a lisp function is the last one
+   above the arguments (a tail call can change their count) */
+static struct akl_value *
+akl_frame_value(struct akl_context *cx)
+{
+    if (akl_vector_count(cx->cx_stack) > cx->cx_frame.fr_bottom
+                                         + cx->cx_frame_len + cx->cx_frame.fr_locals)
+        return akl_stack_top(cx);
+    return AKL_NIL;
+}
+
+/* Reserve the local variable slots of the lisp function, above its
+   arguments (the frame must be initialized) */
+static void
+akl_frame_init_locals(struct akl_context *cx, struct akl_function *fn)
+{
+    unsigned int n;
+    /* The first call of a lazily compiled function */
+    if (fn->fn_body.ufun.uf_lazy != NULL)
+        akl_compile_lazy(cx, fn);
+
+    n = fn->fn_body.ufun.uf_nlocals;
+    cx->cx_frame.fr_locals = n;
+    while (n-- > 0)
+        akl_stack_push(cx, AKL_NIL);
+}
+
 /* XXX: Use this function with care. */
 struct akl_value *akl_call_function_bound(struct akl_context *cx, int argc)
 {
@@ -392,7 +455,9 @@ struct akl_value *akl_call_function_bound(struct akl_context *cx, int argc)
     struct akl_function *fn;
     struct akl_lisp_fun *ufun;
     struct akl_value *value;
-    fn = cx->cx_func;
+    const char *fname;
+    fn    = cx->cx_func;
+    fname = cx->cx_func_name;
 
     akl_init_frame(cx, argc);
 
@@ -402,19 +467,19 @@ struct akl_value *akl_call_function_bound(struct akl_context *cx, int argc)
         if (value == NULL) {
             akl_raise_error(cx, AKL_ERROR
                 , "Function '%s' gave back NULL", cx->cx_func_name);
-            akl_frame_destroy(cx, argc);
-            return NULL;
         }
-        akl_stack_push(cx, value);
         break;
 
         case AKL_FUNC_USER:
         ufun = &fn->fn_body.ufun;
         cx->cx_lex_info = ufun->uf_info;
         cx->cx_ir = &ufun->uf_body;
-        akl_ir_exec_branch(cx, AKL_LIST_FIRST(&ufun->uf_body));
-        value = akl_list_last(cx->cx_stack);
-        //akl_stack_push(cx, value);
+        akl_frame_init_locals(cx, fn);
+        akl_ir_exec_branch(cx, 0);
+        value = akl_frame_value(cx);
+        /* The context can be called again (e.g.: by map) */
+        cx->cx_func      = fn;
+        cx->cx_func_name = fname;
         break;
 
         /* TODO: */
@@ -422,7 +487,10 @@ struct akl_value *akl_call_function_bound(struct akl_context *cx, int argc)
         value = NULL;
         break;
     }
+    /* Replace the arguments with the returned value */
     akl_frame_destroy(cx, argc);
+    if (value != NULL)
+        akl_stack_push(cx, value);
 
     return value;
 }
@@ -434,13 +502,19 @@ akl_call_symbol(struct akl_context *ctx, struct akl_context *cx
     if (ctx == NULL) {
         return NULL;
     }
+    struct akl_value *value;
+    bool_t is_bound = FALSE;
     if (cx == NULL) {
         cx = akl_bound_function(ctx, sym, NULL);
         if (cx == NULL) {
             return NULL;
         }
+        is_bound = TRUE;
     }
-    return akl_call_function_bound(cx, argc);
+    value = akl_call_function_bound(cx, argc);
+    if (is_bound)
+        akl_release_context(cx);
+    return value;
 }
 
 struct akl_function *
@@ -448,11 +522,20 @@ akl_call_sform(struct akl_context *ctx, struct akl_symbol *fsym
                , struct akl_function *sform)
 {
     struct akl_context *cx = akl_bound_function(ctx, fsym, sform);
+    struct akl_function *fn = NULL;
+    /* The special form itself decides which of its parts are
+       in tail position (see cx_parent->cx_is_tail and
+       cx_parent->cx_is_toplevel) */
+    if (cx) {
+        cx->cx_is_tail = FALSE;
+        cx->cx_is_toplevel = FALSE;
+    }
     if (cx && cx->cx_func && cx->cx_func->fn_body.scfun) {
-        return cx->cx_func->fn_body.scfun(cx);
+        fn = cx->cx_func->fn_body.scfun(cx);
     }
-    /* ERROR */
-    return NULL;
+    /* ERROR, if NULL */
+    akl_release_context(cx);
+    return fn;
 }
 
 struct akl_value *
@@ -471,174 +554,624 @@ akl_call_function(struct akl_context *ctx, struct akl_context *cx
     return akl_call_symbol(ctx, cx, sym, argc);
 }
 
-#define MOVE_IP(ip) ((ip) = AKL_LIST_NEXT(ip))
-#define LOOP_WATCHDOG(ent) \
-        if ((ent) == (ent)->le_next) { \
-            fprintf(stderr, "Error, loop in %s()!\n", __func__); \
-            return;\
-        }
+#define MOVE_IP(ip) ((ip)++)
 #define OPERAND(ind, name) (in)->in_arg[ind].name
+/* Arguments of the executed function are indexed from the bottom
+   of the frame, so shifting does not change their place. */
+#define HAS_ARGUMENT(ind) ((ind) < ctx->cx_frame_len)
+#define ARGUMENT(ind) STACK_AT(ctx->cx_stack, ctx->cx_frame.fr_bottom + (ind))
+/* The local variables are right above the arguments */
+#define LOCAL(ind) STACK_AT(ctx->cx_stack, ctx->cx_frame.fr_bottom \
+                            + ctx->cx_frame_len + (ind))
+
+/* Calls and backward jumps are the safe points of the executor:
+   Every infinite loop must go through one of them, so the interpreter
+   is stopped there (on an interruption), and every live value is in a
+   stack (or in the code), so the garbage collection also runs there. */
+#define SAFE_POINT() \
+    do { \
+        if (s->ai_interrupted) { \
+            akl_raise_error(ctx, AKL_WARNING, "Program interruption."); \
+            goto abort_exec; \
+        } \
+        if (s->ai_gc_allocated >= s->ai_gc_threshold \
+                || s->ai_gc_phase != AKL_GC_PHASE_IDLE) \
+            akl_gc_collect(ctx); \
+    } while (0)
+
+#ifdef AKL_THREADED_CODE
+/* Direct-threaded dispatch: Every instruction holds the address of
+   its handler (in_handler), which is resolved by akl_ir_resolve(). */
+static void * const *akl_ir_handlers = NULL;
+
+# define INSTR(op) L_##op:
+# define DISPATCH() \
+    do { \
+        if (ip >= icount) \
+            goto leave_function; \
+        in = &code[ip]; \
+        goto *in->in_handler; \
+    } while (0)
+#else
+# define INSTR(op) case op:
+# define DISPATCH() continue
+#endif
+
+/* Resolve the function called by the CALL instruction and
+   store it in the inline cache of the instruction */
+static struct akl_function *
+akl_ir_cache_call(struct akl_context *ctx, struct akl_ir_instruction *in)
+{
+    struct akl_state *s = ctx->cx_state;
+    struct akl_variable *var = akl_get_global_var(s, OPERAND(0, symbol));
+    /* The code of the running function gets the new references */
+    struct akl_function *owner = ctx->cx_func ? ctx->cx_func : ctx->cx_fn_main;
+    if (owner != NULL)
+        AKL_GC_WRITE_BARRIER(s, owner);
+    s->ai_ic_misses++;
+    if (var == NULL || !akl_var_is_function(var)) {
+        in->in_cvar = NULL;
+        in->in_fun  = NULL;
+    } else {
+        in->in_cvar = var;
+        in->in_cver = var->vr_version;
+        in->in_fun  = akl_var_to_function(var);
+    }
+    return in->in_fun;
+}
+
+/* Fast path of the numeric instructions: Replaces the operands
+   with the result. Gives back FALSE, if the builtin was rebound or
+   the operands are not numbers, then the generic call must be used. */
+static bool_t
+akl_ir_exec_numeric(struct akl_context *ctx, struct akl_ir_instruction *in)
+{
+    struct akl_vector *stack = ctx->cx_stack;
+    unsigned int sp = akl_vector_count(stack);
+    unsigned int argc = OPERAND(1, ui_num);
+    struct akl_value *a, *b, *r;
+    double na, nb = 0.0;
+
+    if (in->in_cvar->vr_version != in->in_cver || sp < argc)
+        return FALSE;
+
+    a = STACK_AT(stack, sp - argc);
+    if (!AKL_CHECK_TYPE(a, AKL_VT_NUMBER))
+        return FALSE;
+    na = AKL_GET_NUMBER_VALUE(a);
+    if (argc == 2) {
+        b = STACK_AT(stack, sp - 1);
+        if (!AKL_CHECK_TYPE(b, AKL_VT_NUMBER))
+            return FALSE;
+        nb = AKL_GET_NUMBER_VALUE(b);
+    }
+
+    switch (in->in_op) {
+        case AKL_IR_ADD:
+        r = AKL_NUMBER(ctx, na + nb);
+        break;
 
+        case AKL_IR_SUB:
+        r = AKL_NUMBER(ctx, na - nb);
+        break;
+
+        case AKL_IR_MUL:
+        r = AKL_NUMBER(ctx, na * nb);
+        break;
+
+        case AKL_IR_DIV:
+        /* Let the builtin raise the error */
+        if (nb == 0.0)
+            return FALSE;
+        r = AKL_NUMBER(ctx, na / nb);
+        break;
+
+        case AKL_IR_LT:
+        r = (na < nb) ? AKL_TRUE : AKL_NIL;
+        break;
+
+        case AKL_IR_GT:
+        r = (na > nb) ? AKL_TRUE : AKL_NIL;
+        break;
+
+        case AKL_IR_EQ:
+        r = (na == nb) ? AKL_TRUE : AKL_NIL;
+        break;
+
+        case AKL_IR_INC:
+        r = AKL_NUMBER(ctx, na + 1);
+        break;
+
+        case AKL_IR_DEC:
+        r = AKL_NUMBER(ctx, na - 1);
+        break;
+
+        default:
+        return FALSE;
+    }
+    STACK_AT(stack, sp - argc) = r;
+    stack->av_count = sp - argc + 1;
+    return TRUE;
+}
+
+/* Find the target of the SWITCH instruction for the value */
+static struct akl_label *
+akl_switch_find(struct akl_switch *sw, struct akl_value *v)
+{
+    struct akl_switch_entry *e;
+    struct akl_symbol *sym = NULL;
+    struct akl_label *l;
+    unsigned int h;
+    long num = 0;
+    double d;
+
+    if (v == NULL) {
+        return sw->sw_default;
+    } else if (AKL_CHECK_TYPE(v, AKL_VT_NUMBER)) {
+        d = AKL_GET_NUMBER_VALUE(v);
+        num = (long)d;
+        if ((double)num != d)
+            return sw->sw_default;
+        if (sw->sw_table != NULL) {
+            if (num < sw->sw_min || (unsigned long)(num - sw->sw_min) >= sw->sw_range)
+                return sw->sw_default;
+            l = sw->sw_table[num - sw->sw_min];
+            return (l != NULL) ? l : sw->sw_default;
+        }
+    } else if (AKL_CHECK_TYPE(v, AKL_VT_SYMBOL)) {
+        sym = v->va_value.symbol;
+    } else {
+        return sw->sw_default;
+    }
+
+    if (sw->sw_hash_size == 0)
+        return sw->sw_default;
+    h = akl_switch_hash(sym, num) & (sw->sw_hash_size - 1);
+    for (e = &sw->sw_hash[h]; e->se_label != NULL; e = &sw->sw_hash[h]) {
+        if (e->se_sym == sym && e->se_num == num)
+            return e->se_label;
+        h = (h + 1) & (sw->sw_hash_size - 1);
+    }
+    return sw->sw_default;
+}
+
+/* Give back the contexts of the unfinished lisp functions,
+   called from the 'entry' context (after an error) */
+static void
+akl_ir_unwind(struct akl_context *ctx, struct akl_context *entry)
+{
+    struct akl_context *cx = NULL;
+    while (ctx != entry && ctx != NULL) {
+        cx  = ctx;
+        ctx = ctx->cx_parent;
+    }
+    if (cx != NULL) {
+        akl_frame_destroy(cx, 0);
+        akl_release_context(cx);
+    }
+}
+
+/* Execute the current IR (ctx->cx_ir), from the given offset.
+   The lisp functions are called inside the same loop: The caller's
+   return address is saved to its context (cx_ip), and the callee gets
+   the next context from the call stack. Only the C functions are
+   called recursively.
+   When called with a NULL context, it only exports the handler
+   table (for the threaded mode). */
 static void
-akl_ir_exec_branch(struct akl_context *ctx, struct akl_list_entry *ip)
+akl_ir_exec_branch(struct akl_context *ctx, unsigned int ip)
 {
-    struct akl_list  *ir = ctx->cx_ir;
-    struct akl_state *s  = ctx->cx_state;
+    struct akl_vector *ir;
+    struct akl_state  *s;
 
     struct akl_label *lt = NULL, *ln = NULL;
+    struct akl_context *entry = ctx;
     struct akl_context *cx = NULL;
-    struct akl_ir_instruction *in;
+    struct akl_ir_instruction *code, *in;
     struct akl_value *v, *lv;
     struct akl_variable *var;
     struct akl_symbol *sym;
+    struct akl_function *fn;
+    struct akl_list *li;
+    unsigned int icount, sp, argc;
+
+#ifdef AKL_THREADED_CODE
+    /* Must be in the same order as akl_ir_instruction_t */
+    static void * const handlers[AKL_NR_INSTRUCTIONS] = {
+        &&L_AKL_IR_NOP, &&L_AKL_IR_PUSH, &&L_AKL_IR_LOAD, &&L_AKL_IR_CALL
+      , &&L_AKL_IR_GET, &&L_AKL_IR_SET, &&L_AKL_IR_BRANCH, &&L_AKL_IR_JMP
+      , &&L_AKL_IR_JT, &&L_AKL_IR_JN, &&L_AKL_IR_HEAD, &&L_AKL_IR_TAIL
+      , &&L_AKL_IR_RET, &&L_AKL_IR_ADD, &&L_AKL_IR_SUB, &&L_AKL_IR_MUL
+      , &&L_AKL_IR_DIV, &&L_AKL_IR_LT, &&L_AKL_IR_GT, &&L_AKL_IR_EQ
+      , &&L_AKL_IR_INC, &&L_AKL_IR_DEC, &&L_AKL_IR_LOAD2, &&L_AKL_IR_TAILCALL
+      , &&L_AKL_IR_LOCAL_GET, &&L_AKL_IR_LOCAL_SET, &&L_AKL_IR_CAPTURE_LOAD
+      , &&L_AKL_IR_CLOSURE, &&L_AKL_IR_SWITCH, &&L_AKL_IR_POP, &&L_AKL_IR_LIST_ITER
+      , &&L_AKL_IR_LIST_NEXT, &&L_AKL_IR_NUMBER_CHECK
+    };
 
-    if (ir == NULL || ip == NULL)
+    if (ctx == NULL) {
+        akl_ir_handlers = handlers;
+        return;
+    }
+#endif
+    if (ctx == NULL || ctx->cx_ir == NULL)
         return;
 
-    while (ip) {
-        if (s && s->ai_interrupted) {
-            akl_raise_error(ctx, AKL_WARNING, "Program interruption.");
-            return;
-        }
-
-        in = (struct akl_ir_instruction *)ip->le_data;
-        LOOP_WATCHDOG(ip);
+    ir     = ctx->cx_ir;
+    s      = ctx->cx_state;
+    code   = (struct akl_ir_instruction *)akl_vector_first(ir);
+    icount = akl_vector_count(ir);
+    SAFE_POINT();
+
+#ifdef AKL_THREADED_CODE
+    DISPATCH();
+#else
+    for (;;) {
+        if (ip >= icount)
+            goto leave_function;
+        in = &code[ip];
         switch (in->in_op) {
-        case AKL_IR_NOP:
+#endif
+        INSTR(AKL_IR_NOP)
             MOVE_IP(ip);
-        break;
+        DISPATCH();
 
-        case AKL_IR_SET:
+        INSTR(AKL_IR_SET)
             /* Set does not remove the top stack value */
             v = akl_stack_top(ctx);
             if (v != NULL) {
-                ctx->cx_lex_info = v->va_lex_info;
-                akl_set_global_var(s, OPERAND(0, symbol), NULL, TRUE, v);
+                ctx->cx_lex_info = AKL_LEX_INFO(v);
+                akl_bind_var(s, OPERAND(1, var), NULL, TRUE, v);
             }
             MOVE_IP(ip);
-        break;
-
-        case AKL_IR_GET:
-            sym = OPERAND(0, symbol);
-            var = akl_get_global_var(s, sym);
-            if (!var) {
-                akl_raise_error(ctx, AKL_ERROR, "Variable '%s' is undefined.", sym->sb_name);
-                akl_stack_push(ctx, akl_new_nil_value(s));
+        DISPATCH();
+
+        INSTR(AKL_IR_GET)
+            var = OPERAND(1, var);
+            if (var->vr_value == NULL) {
+                akl_raise_error(ctx, AKL_ERROR, "Variable '%s' is undefined."
+                                , OPERAND(0, symbol)->sb_name);
+                akl_stack_push(ctx, AKL_NIL);
             } else {
                 ctx->cx_lex_info = var->vr_lex_info;
                 akl_stack_push(ctx, var->vr_value);
             }
             MOVE_IP(ip);
-        break;
+        DISPATCH();
 
-        case AKL_IR_PUSH:
+        INSTR(AKL_IR_PUSH)
             v = OPERAND(0, value);
             if (v == NULL) {
                 akl_raise_error(ctx, AKL_WARNING, "Interpreter error: NULL pushed to stack.");
-                return;
+                goto abort_exec;
             }
-            ctx->cx_lex_info = v->va_lex_info;
+            ctx->cx_lex_info = AKL_LEX_INFO(v);
             akl_stack_push(ctx, v);
             MOVE_IP(ip);
-        break;
+        DISPATCH();
 
-        case AKL_IR_LOAD:
-            /* TODO: Error if ui_num < 0 */
-            v = akl_frame_at(ctx, OPERAND(0, ui_num));
-            if (v) {
-                ctx->cx_lex_info = v->va_lex_info;
+        INSTR(AKL_IR_LOAD)
+            if (HAS_ARGUMENT(OPERAND(0, ui_num))) {
+                v = ARGUMENT(OPERAND(0, ui_num));
+                ctx->cx_lex_info = AKL_LEX_INFO(v);
                 akl_stack_push(ctx, v);
             }
             MOVE_IP(ip);
-        break;
+        DISPATCH();
 
-        case AKL_IR_CALL:
-            ctx->cx_lex_info = in->in_linfo;
-            if (in->in_fun) {
-                cx = akl_bound_function(ctx, OPERAND(0, symbol), in->in_fun);
-                if (cx == NULL) {
-                    MOVE_IP(ip);
-                    continue;
+        INSTR(AKL_IR_TAILCALL)
+            sym = OPERAND(0, symbol);
+            if (sym != NULL) {
+                if (in->in_cvar && in->in_cvar->vr_version == in->in_cver) {
+                    s->ai_ic_hits++;
+                } else {
+                    akl_ir_cache_call(ctx, in);
                 }
+            }
+            fn = in->in_fun;
+            /* Only lisp functions can replace the current one */
+            if (fn == NULL || fn->fn_type != AKL_FUNC_USER)
+                goto call_function;
+
+            SAFE_POINT();
+            /* Move the arguments to the place of the current ones */
+            sp   = akl_vector_count(ctx->cx_stack);
+            argc = OPERAND(1, ui_num);
+            if (argc > sp - ctx->cx_frame.fr_bottom)
+                argc = sp - ctx->cx_frame.fr_bottom;
+            memmove(&STACK_AT(ctx->cx_stack, ctx->cx_frame.fr_bottom)
+                    , &STACK_AT(ctx->cx_stack, sp - argc)
+                    , argc * sizeof(struct akl_value *));
+            ctx->cx_stack->av_count = ctx->cx_frame.fr_bottom + argc;
+            ctx->cx_frame.fr_base   = ctx->cx_frame.fr_bottom;
+            ctx->cx_frame.fr_count  = argc;
+            ctx->cx_frame_len       = argc;
+            akl_frame_init_locals(ctx, fn);
+
+            ctx->cx_func      = fn;
+            ctx->cx_func_name = (sym != NULL) ? sym->sb_name : "lambda";
+            ctx->cx_lex_info  = fn->fn_body.ufun.uf_info;
+            ctx->cx_ir = ir   = &fn->fn_body.ufun.uf_body;
+            code   = (struct akl_ir_instruction *)akl_vector_first(ir);
+            icount = akl_vector_count(ir);
+            ip     = 0;
+        DISPATCH();
+
+        INSTR(AKL_IR_CALL)
+            sym = OPERAND(0, symbol);
+            if (sym != NULL) {
+                if (in->in_cvar && in->in_cvar->vr_version == in->in_cver) {
+                    s->ai_ic_hits++;
+                } else {
+                    akl_ir_cache_call(ctx, in);
+                }
+            }
+            fn = in->in_fun;
+        call_function:
+            SAFE_POINT();
+            ctx->cx_lex_info = in->in_linfo;
+            MOVE_IP(ip);
+            /* With NULL function, this will raise the right error */
+            cx = akl_bound_function(ctx, sym, fn);
+            if (cx == NULL) {
+                /* No result can be made up for a too deep call */
+                if (s->ai_call_depth >= AKL_CALL_STACK_SIZE)
+                    goto abort_exec;
+                DISPATCH();
+            }
+
+            if (cx->cx_func->fn_type != AKL_FUNC_USER) {
                 akl_call_function_bound(cx, OPERAND(1, ui_num));
-            } else {
-                akl_call_symbol(ctx, NULL, OPERAND(0, symbol), OPERAND(1, ui_num));
+                akl_release_context(cx);
+                DISPATCH();
+            }
+            /* Lisp function: Continue with its code */
+            ctx->cx_ip = ip;
+            akl_init_frame(cx, OPERAND(1, ui_num));
+            akl_frame_init_locals(cx, cx->cx_func);
+            ctx = cx;
+            ctx->cx_lex_info = ctx->cx_func->fn_body.ufun.uf_info;
+            ctx->cx_ir = ir  = &ctx->cx_func->fn_body.ufun.uf_body;
+            code   = (struct akl_ir_instruction *)akl_vector_first(ir);
+            icount = akl_vector_count(ir);
+            ip     = 0;
+        DISPATCH();
+
+        INSTR(AKL_IR_LOAD2)
+            if (HAS_ARGUMENT(OPERAND(0, ui_num))) {
+                v = ARGUMENT(OPERAND(0, ui_num));
+                akl_stack_push(ctx, v);
+            }
+            if (HAS_ARGUMENT(OPERAND(1, ui_num))) {
+                v = ARGUMENT(OPERAND(1, ui_num));
+                ctx->cx_lex_info = AKL_LEX_INFO(v);
+                akl_stack_push(ctx, v);
             }
             MOVE_IP(ip);
-        break;
+        DISPATCH();
+
+        INSTR(AKL_IR_LOCAL_GET)
+            v = LOCAL(OPERAND(0, ui_num));
+            ctx->cx_lex_info = AKL_LEX_INFO(v);
+            akl_stack_push(ctx, v);
+            MOVE_IP(ip);
+        DISPATCH();
+
+        INSTR(AKL_IR_LOCAL_SET)
+            /* Keep the value on the stack, if the second operand is set */
+            v = OPERAND(1, ui_num) ? akl_stack_top(ctx) : akl_stack_pop(ctx);
+            if (v != NULL)
+                LOCAL(OPERAND(0, ui_num)) = v;
+            MOVE_IP(ip);
+        DISPATCH();
+
+        INSTR(AKL_IR_CAPTURE_LOAD)
+            /* The lambda itself has no values (only its closures) */
+            v = (ctx->cx_func->fn_captures != NULL)
+                ? ctx->cx_func->fn_captures[OPERAND(0, ui_num)] : AKL_NIL;
+            akl_stack_push(ctx, v);
+            MOVE_IP(ip);
+        DISPATCH();
+
+        INSTR(AKL_IR_CLOSURE)
+            /* The captured values are on the top of the stack */
+            sp   = akl_vector_count(ctx->cx_stack);
+            argc = OPERAND(0, ui_num);
+            fn   = akl_new_closure(s, in->in_fun, &STACK_AT(ctx->cx_stack, sp - argc));
+            ctx->cx_stack->av_count = sp - argc;
+            akl_stack_push(ctx, akl_new_function_value(s, fn));
+            MOVE_IP(ip);
+        DISPATCH();
+
+        INSTR(AKL_IR_ADD)
+        INSTR(AKL_IR_SUB)
+        INSTR(AKL_IR_MUL)
+        INSTR(AKL_IR_DIV)
+        INSTR(AKL_IR_LT)
+        INSTR(AKL_IR_GT)
+        INSTR(AKL_IR_EQ)
+        INSTR(AKL_IR_INC)
+        INSTR(AKL_IR_DEC)
+            if (akl_ir_exec_numeric(ctx, in)) {
+                MOVE_IP(ip);
+                DISPATCH();
+            }
+            /* The cache of these instructions always holds the builtin,
+               so the call must look up the current binding. */
+            sym = OPERAND(0, symbol);
+            fn  = NULL;
+            goto call_function;
 
-        case AKL_IR_HEAD:
-            v = akl_frame_at(ctx, in->in_arg[0].ui_num);
-            if (v) {
+        INSTR(AKL_IR_HEAD)
+            if (HAS_ARGUMENT(OPERAND(0, ui_num))) {
+                v = ARGUMENT(OPERAND(0, ui_num));
                 akl_stack_push(ctx, akl_car(AKL_GET_LIST_VALUE(v)));
             }
             MOVE_IP(ip);
-        break;
+        DISPATCH();
 
-        case AKL_IR_TAIL:
-            v = akl_frame_at(ctx, OPERAND(0, ui_num));
-            if (v) {
+        INSTR(AKL_IR_TAIL)
+            if (HAS_ARGUMENT(OPERAND(0, ui_num))) {
+                v = ARGUMENT(OPERAND(0, ui_num));
                 lv = akl_new_list_value(ctx->cx_state
                         , akl_cdr(ctx->cx_state, AKL_GET_LIST_VALUE(v)));
                 akl_stack_push(ctx, lv);
             }
             MOVE_IP(ip);
-        break;
+        DISPATCH();
 
-        case AKL_IR_JMP:
+        INSTR(AKL_IR_JMP)
             lt = OPERAND(0, label);
-            ir = lt->la_ir;
+            if (lt->la_branch <= ip)
+                SAFE_POINT();
             ip = lt->la_branch;
-        break;
+        DISPATCH();
 
-        case AKL_IR_JT:
+        INSTR(AKL_IR_JT)
             lt = OPERAND(0, label);
             v = akl_stack_pop(ctx);
             /* TODO: Error on other types */
             if (AKL_IS_TRUE(v)) {
-                ir = lt->la_ir;
+                if (lt->la_branch <= ip)
+                    SAFE_POINT();
                 ip = lt->la_branch;
             } else {
                 MOVE_IP(ip);
             }
-        break;
+        DISPATCH();
 
-        case AKL_IR_JN:
+        INSTR(AKL_IR_JN)
             ln = OPERAND(0, label);
             v = akl_stack_pop(ctx);
             /* TODO: Error on other types */
             if (AKL_IS_NIL(v)) {
-                ir = ln->la_ir;
+                if (ln->la_branch <= ip)
+                    SAFE_POINT();
                 ip = ln->la_branch;
             } else {
                 MOVE_IP(ip);
             }
-        break;
+        DISPATCH();
 
-        case AKL_IR_BRANCH:
+        INSTR(AKL_IR_BRANCH)
             lt = OPERAND(0, label);
             ln = OPERAND(0, label);
             v = akl_stack_pop(ctx);
             /* TODO: Error on other types */
             if (AKL_IS_NIL(v)) {
-                ir = ln->la_ir;
                 ip = ln->la_branch;
             } else {
-                ir = lt->la_ir;
                 ip = lt->la_branch;
             }
-        break;
+            if (ip <= (unsigned int)(in - code))
+                SAFE_POINT();
+        DISPATCH();
 
-        case AKL_IR_RET:
-            /* TODO */
+        INSTR(AKL_IR_SWITCH)
+            v = akl_stack_pop(ctx);
+            /* The branches are always after the switch */
+            ip = akl_switch_find(OPERAND(0, swtch), v)->la_branch;
+        DISPATCH();
+
+        INSTR(AKL_IR_POP)
+            akl_stack_pop(ctx);
             MOVE_IP(ip);
-        break;
+        DISPATCH();
+
+        INSTR(AKL_IR_NUMBER_CHECK)
+            /* With a bad limit, the loop is not run at all */
+            v = akl_stack_pop(ctx);
+            if (v == NULL || !AKL_CHECK_TYPE(v, AKL_VT_NUMBER)) {
+                akl_raise_error(ctx, AKL_ERROR, "The limit of the loop must be a number");
+                v = AKL_NUMBER(ctx, 0);
+            }
+            akl_stack_push(ctx, v);
+            MOVE_IP(ip);
+        DISPATCH();
+
+        INSTR(AKL_IR_LIST_ITER)
+            /* The iterator is a new list header, which shares the
+               elements, and it is shortened from the head by LIST_NEXT */
+            v = akl_stack_pop(ctx);
+            li = akl_new_list(s);
+            li->is_nil = TRUE;
+            if (v != NULL && AKL_CHECK_TYPE(v, AKL_VT_LIST) && AKL_GET_LIST_VALUE(v) != NULL) {
+                li->li_head  = AKL_GET_LIST_VALUE(v)->li_head;
+                li->li_last  = AKL_GET_LIST_VALUE(v)->li_last;
+                li->li_count = AKL_GET_LIST_VALUE(v)->li_count;
+                li->is_nil   = (li->li_count == 0);
+            } else if (v != NULL && !AKL_IS_NIL(v)) {
+                akl_raise_error(ctx, AKL_ERROR, "Iteration over a non-list value");
+            }
+            akl_stack_push(ctx, akl_new_list_value(s, li));
+            MOVE_IP(ip);
+        DISPATCH();
+
+        INSTR(AKL_IR_LIST_NEXT)
+            li = AKL_GET_LIST_VALUE(LOCAL(OPERAND(1, ui_num)));
+            if (li->li_head == NULL || li->li_count == 0) {
+                ip = OPERAND(0, label)->la_branch;
+            } else {
+                akl_stack_push(ctx, AKL_ENTRY_VALUE(li->li_head));
+                li->li_head = li->li_head->le_next;
+                if (--li->li_count == 0)
+                    li->is_nil = TRUE;
+                MOVE_IP(ip);
+            }
+        DISPATCH();
+
+        INSTR(AKL_IR_RET)
+        leave_function:
+            /* The returned value is on the top of the stack */
+            if (ctx == entry)
+                return;
+
+            /* Replace the frame with the value and go back to the caller */
+            v  = akl_frame_value(ctx);
+            cx = ctx;
+            ctx = ctx->cx_parent;
+            akl_frame_destroy(cx, 0);
+            akl_release_context(cx);
+            akl_stack_push(ctx, v);
 
+            ir     = ctx->cx_ir;
+            code   = (struct akl_ir_instruction *)akl_vector_first(ir);
+            icount = akl_vector_count(ir);
+            ip     = ctx->cx_ip;
+        DISPATCH();
+#ifndef AKL_THREADED_CODE
         default:
             akl_raise_error(ctx, AKL_ERROR, "Unkown instruction '%#x'", in->in_op);
-        return;
+            goto abort_exec;
         }
     }
+#endif
+
+abort_exec:
+    akl_ir_unwind(ctx, entry);
+    /* The aborted code has no result (see akl_frame_value()) */
+    sp = entry->cx_frame.fr_bottom + entry->cx_frame_len
+       + entry->cx_frame.fr_locals;
+    if (akl_vector_count(entry->cx_stack) > sp)
+        entry->cx_stack->av_count = sp;
+}
+
+/* Resolve the handler address of every instruction in the given code.
+   Must be called before the code is executed (see akl_ir_finalize()). */
+void akl_ir_resolve(struct akl_vector *ir)
+{
+#ifdef AKL_THREADED_CODE
+    struct akl_ir_instruction *in;
+    unsigned int i;
+    if (akl_ir_handlers == NULL)
+        akl_ir_exec_branch(NULL, 0);
+
+    AKL_VECTOR_FOREACH(i, in, ir) {
+        in->in_handler = akl_ir_handlers[in->in_op];
+    }
+#else
+    (void)ir;
+#endif
 }
 
 static void
@@ -652,17 +1185,32 @@ dump_jmp(struct akl_state *s, const char *jname, struct akl_ir_instruction *in)
     }
 }
 
+/* Print the labels pointing to the given instruction offset */
+static void
+dump_labels(struct akl_state *s, struct akl_lisp_fun *uf, unsigned int ip)
+{
+    struct akl_list_entry *lit;
+    struct akl_label *l;
+    lit = akl_list_it_begin(&uf->uf_labels);
+    /* Itarate through the label's list, to find a label with
+       the same offset. */
+    while ((l = akl_list_it_next(&lit)) != NULL) {
+        if (l->la_branch == ip) {
+            printf("%s.L%d:%s\n", AKL_COLORFUL(s, AKL_YELLOW)
+                                , l->la_ind, AKL_END_COLORFUL(s));
+        }
+    }
+}
+
 void akl_dump_ir(struct akl_context *ctx, struct akl_function *fun)
 {
     assert(ctx);
-    struct akl_list *ir;
-    struct akl_list_entry *ent, *lit;
+    struct akl_vector *ir;
     struct akl_ir_instruction *in;
-    struct akl_label *l = NULL;
+    unsigned int ip;
     struct akl_lisp_fun *uf = NULL;
     struct akl_symbol *sym;
     struct akl_state *s = ctx->cx_state;
-    int lind = 0;
 
     if (fun->fn_type == AKL_FUNC_CFUN 
      || fun->fn_type == AKL_FUNC_SPECIAL) {
@@ -670,26 +1218,10 @@ void akl_dump_ir(struct akl_context *ctx, struct akl_function *fun)
         return;
     }
     uf = &fun->fn_body.ufun;
-    l = (struct akl_label *)akl_list_head(&uf->uf_labels);
-
     ir = &uf->uf_body;
-    AKL_LIST_FOREACH(ent, ir) {
-       in = (struct akl_ir_instruction *)ent->le_data;
-       if (in == NULL)
-           break;
-
-       LOOP_WATCHDOG(ent);
+    AKL_VECTOR_FOREACH(ip, in, ir) {
        /* If this instruction is labeled, print that label first */
-       lit = akl_list_it_begin(&uf->uf_labels);
-       /* Itarate through the label's list, to find a label with
-          the same address. */
-       while ((l = akl_list_it_next(&lit)) != NULL) {
-           if (l && l->la_branch == ent) {
-               printf("%s.L%d:%s\n", AKL_COLORFUL(s, AKL_YELLOW)
-                                   , l->la_ind, AKL_END_COLORFUL(s));
-               lind++;
-           }
-       }
+       dump_labels(s, uf, ip);
 
        printf("\t");
        switch (in->in_op) {
@@ -740,6 +1272,30 @@ void akl_dump_ir(struct akl_context *ctx, struct akl_function *fun)
             }
             break;
 
+            case AKL_IR_CAPTURE_LOAD:
+            case AKL_IR_CLOSURE:
+            case AKL_IR_LOCAL_GET:
+            case AKL_IR_LOCAL_SET:
+            if (AKL_IS_FEATURE_ON(s, AKL_CFG_USE_COLORS)) {
+                printf("%s%s %s$%d%s", AKL_BLUE, akl_ir_instruction_set[in->in_op]
+                       , AKL_BRIGHT_YELLOW, OPERAND(0, ui_num), AKL_END_COLOR_MARK);
+            } else {
+                printf("%s $%d", akl_ir_instruction_set[in->in_op], OPERAND(0, ui_num));
+            }
+            if (in->in_op == AKL_IR_LOCAL_SET && OPERAND(1, ui_num))
+                printf(", keep");
+            break;
+
+            case AKL_IR_LOAD2:
+            if (AKL_IS_FEATURE_ON(s, AKL_CFG_USE_COLORS)) {
+                printf("%sload2 %s%%%d%s, %s%%%d%s", AKL_BLUE, AKL_BRIGHT_YELLOW
+                           , OPERAND(0, ui_num), AKL_END_COLOR_MARK, AKL_BRIGHT_YELLOW
+                           , OPERAND(1, ui_num), AKL_END_COLOR_MARK);
+            } else {
+                printf("load2 %%%d, %%%d", OPERAND(0, ui_num), OPERAND(1, ui_num));
+            }
+            break;
+
             case AKL_IR_SET:
             if (AKL_IS_FEATURE_ON(s, AKL_CFG_USE_COLORS)) {
                 printf("%sset %s%s%s", AKL_BLUE, AKL_PURPLE
@@ -775,16 +1331,69 @@ void akl_dump_ir(struct akl_context *ctx, struct akl_function *fun)
             printf("tail %d", OPERAND(0, ui_num));
             break;
 
+            case AKL_IR_TAILCALL:
+            sym = OPERAND(0, symbol);
+            if (sym == NULL || sym->sb_name == NULL)
+                break;
+
+            if (AKL_IS_FEATURE_ON(s, AKL_CFG_USE_COLORS)) {
+                printf("%stailcall %s%s%s, %s%d%s", AKL_BLUE, AKL_PURPLE, sym->sb_name
+                       , AKL_END_COLOR_MARK, AKL_YELLOW, OPERAND(1, ui_num), AKL_END_COLOR_MARK);
+            } else {
+                printf("tailcall %s, %d", sym->sb_name, OPERAND(1, ui_num));
+            }
+            break;
+
+            case AKL_IR_SWITCH:
+            if (AKL_IS_FEATURE_ON(s, AKL_CFG_USE_COLORS)) {
+                printf("%sswitch %s%d%s, %s.L%d%s", AKL_BLUE, AKL_YELLOW
+                       , akl_vector_count(&OPERAND(0, swtch)->sw_keys), AKL_END_COLOR_MARK
+                       , AKL_YELLOW, OPERAND(0, swtch)->sw_default->la_ind, AKL_END_COLOR_MARK);
+            } else {
+                printf("switch %d, .L%d", akl_vector_count(&OPERAND(0, swtch)->sw_keys)
+                       , OPERAND(0, swtch)->sw_default->la_ind);
+            }
+            break;
+
+            case AKL_IR_LIST_NEXT:
+            if (AKL_IS_FEATURE_ON(s, AKL_CFG_USE_COLORS)) {
+                printf("%slist-next %s$%d%s, %s.L%d%s", AKL_BLUE, AKL_BRIGHT_YELLOW
+                       , OPERAND(1, ui_num), AKL_END_COLOR_MARK, AKL_YELLOW
+                       , OPERAND(0, label)->la_ind, AKL_END_COLOR_MARK);
+            } else {
+                printf("list-next $%d, .L%d", OPERAND(1, ui_num), OPERAND(0, label)->la_ind);
+            }
+            break;
+
+            case AKL_IR_POP:
+            case AKL_IR_LIST_ITER:
+            case AKL_IR_NUMBER_CHECK:
+            if (AKL_IS_FEATURE_ON(s, AKL_CFG_USE_COLORS)) {
+                printf("%s%s%s", AKL_BLUE, akl_ir_instruction_set[in->in_op], AKL_END_COLOR_MARK);
+            } else {
+                printf("%s", akl_ir_instruction_set[in->in_op]);
+            }
+            break;
+
             case AKL_IR_RET:
             printf("ret");
             break;
 
+            case AKL_IR_ADD: case AKL_IR_SUB: case AKL_IR_MUL:
+            case AKL_IR_DIV: case AKL_IR_LT:  case AKL_IR_GT:
+            case AKL_IR_EQ:  case AKL_IR_INC: case AKL_IR_DEC:
+            printf("%s%s%s", AKL_COLORFUL(s, AKL_BLUE)
+                   , akl_ir_instruction_set[in->in_op], AKL_END_COLORFUL(s));
+            break;
+
             default:
             akl_raise_error(ctx, AKL_ERROR, "Unknown instruction '%x'", in->in_op);
             break;
        }
        printf("\n");
     }
+    /* Labels pointing to the end of the function */
+    dump_labels(s, uf, ip);
 }
 
 void akl_clear_ir(struct akl_context *ctx)
@@ -792,24 +1401,22 @@ void akl_clear_ir(struct akl_context *ctx)
     if (!ctx || !ctx->cx_ir)
         return;
 
-    while (akl_list_count(ctx->cx_ir) != 0)
-        akl_list_pop(ctx->cx_ir);
+    ctx->cx_ir->av_count = 0;
 }
 
 void akl_dump_stack(struct akl_context *ctx)
 {
-    struct akl_list *stack = ctx->cx_stack;
+    struct akl_vector *stack = ctx->cx_stack;
     struct akl_value *value = NULL;
-    struct akl_list_entry *ent = akl_list_it_end(stack);
     int i = 0;
+    int ind = akl_vector_count(stack);
 
     printf("--- Stack Dump ---\n");
-    while (ent) {
+    while (ind--) {
        printf("\t%s%%%d%s - ", AKL_COLORFUL(ctx->cx_state, AKL_BRIGHT_YELLOW)
                            , i, AKL_END_COLORFUL(ctx->cx_state));
-       value = AKL_ENTRY_VALUE(ent);
+       value = STACK_AT(stack, ind);
        akl_print_value(ctx->cx_state, value);
-       akl_list_it_prev(&ent);
        printf("\n");
        i++;
     }
@@ -817,7 +1424,7 @@ void akl_dump_stack(struct akl_context *ctx)
 
 void akl_execute_ir(struct akl_context *ctx)
 {
-    akl_ir_exec_branch(ctx, AKL_LIST_FIRST(ctx->cx_ir));
+    akl_ir_exec_branch(ctx, 0);
 }
 
 void akl_execute(struct akl_context *ctx)
@@ -829,8 +1436,11 @@ void akl_execute(struct akl_context *ctx)
     //struct akl_value *v = akl_get_global_value(ctx->cx_state, "*args*");
     //ctx->cx_stack = &ctx->cx_state->ai_stack;
     //akl_frame_push(ctx,  AKL_NULLER(v));
-    ctx->cx_stack = akl_new_list(ctx->cx_state);
-    akl_ir_exec_branch(ctx, AKL_LIST_FIRST(&mfir->uf_body));
+    ctx->cx_stack = akl_new_vector(ctx->cx_state, AKL_STACK_DEFSIZE
+                                   , sizeof(struct akl_value *));
+    ctx->cx_ir    = &mfir->uf_body;
+    akl_frame_init_locals(ctx, mf);
+    akl_ir_exec_branch(ctx, 0);
 }
 
 struct akl_value *
@@ -862,12 +1472,15 @@ int akl_compare_values(void *c1, void *c2)
     struct akl_list *l1, *l2;
     struct akl_list_entry *e1, *e2;
     long l1c, l2c, r;
+    double n1, n2;
 
-    if (v1->va_type == v2->va_type) {
-        switch (v1->va_type) {
+    if (AKL_TYPE(v1) == AKL_TYPE(v2)) {
+        switch (AKL_TYPE(v1)) {
             case AKL_VT_NUMBER:
-            return compare_numbers(AKL_GET_NUMBER_VALUE(v1)
-                                   , AKL_GET_NUMBER_VALUE(v2));
+            /* Must not truncate, like compare_numbers() */
+            n1 = AKL_GET_NUMBER_VALUE(v1);
+            n2 = AKL_GET_NUMBER_VALUE(v2);
+            return (n1 == n2) ? 0 : ((n1 > n2) ? 1 : -1);
 
             case AKL_VT_STRING:
             a = AKL_GET_STRING_VALUE(v1);
@@ -988,6 +1601,8 @@ void akl_raise_error(struct akl_context *ctx
             err->err_type = type;
             err->err_msg = msg;
             akl_list_append(s, s->ai_errors, (void *)err);
+        } else {
+            akl_free(s, msg, 0);
         }
     }
 }
@@ -997,10 +1612,12 @@ void akl_clear_errors(struct akl_state *in)
     struct akl_list_entry *ent, *tmp;
     struct akl_error *err;
     if (in && in->ai_errors) {
-        AKL_LIST_FOREACH_SAFE(ent, in->ai_errors, tmp) {
+        /* AKL_LIST_FOREACH_SAFE() would stop before the last entry */
+        for (ent = in->ai_errors->li_head; ent != NULL; ent = tmp) {
+            tmp = ent->le_next;
             err = (struct akl_error *)ent->le_data;
-           akl_free(in, (void *)err->err_msg, 0);
-           AKL_FREE(in, err);
+            akl_free(in, (void *)err->err_msg, 0);
+            AKL_FREE(in, err);
         }
         in->ai_errors->li_count = 0;
         in->ai_errors->li_head = NULL;
@@ -30,6 +30,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include "akl_tree.h"
 
 #ifndef AKL_MALLOC
@@ -44,8 +45,8 @@
 # define AKL_STRDUP(str) strdup(str)
 #endif // AKL_STRDUP
 
-#define AKL_CHECK_TYPE(v1, type) (((v1) && (v1)->va_type == (type)) ? TRUE : FALSE)
-#define AKL_TYPE(value) (value->va_type)
+#define AKL_CHECK_TYPE(v1, type) (((v1) && AKL_TYPE(v1) == (type)) ? TRUE : FALSE)
+#define AKL_TYPE(value) (AKL_IS_IMMEDIATE(value) ? AKL_VT_NUMBER : (value)->va_type)
 #define AKL_GET_VALUE_MEMBER_PTR(val, type, member) \
                             ((AKL_CHECK_TYPE(val, type) \
                             ? (val)->va_value.member : NULL))
@@ -54,7 +55,9 @@
                             ((AKL_CHECK_TYPE(val, type) \
                             ? (val)->va_value.member : 0))
 
-#define AKL_GET_NUMBER_VALUE(val) (AKL_GET_VALUE_MEMBER(val, AKL_VT_NUMBER, number))
+#define AKL_GET_NUMBER_VALUE(val) (AKL_IS_IMMEDIATE(val) \
+                            ? akl_immediate_to_number(val) \
+                            : AKL_GET_VALUE_MEMBER(val, AKL_VT_NUMBER, number))
 #define AKL_GET_STRING_VALUE(val) (AKL_GET_VALUE_MEMBER_PTR(val, AKL_VT_STRING, string))
 #define AKL_GET_LIST_VALUE(val) (AKL_GET_VALUE_MEMBER_PTR(val, AKL_VT_LIST, list))
 #define AKL_STACK_SIZE 32
@@ -134,15 +137,22 @@ typedef int (*akl_cmp_fn_t)(void *, void *);
 #define __unused __attribute__((unused))
 #endif // __unused
 
-#define AKL_IS_NIL(type)    ((type) == NULL || (type)->is_nil)
-#define AKL_IS_QUOTED(type) ((type)->is_quoted)
+#define AKL_IS_NIL(type)    ((type) == NULL || (!AKL_IS_IMMEDIATE(type) && (type)->is_nil))
+#define AKL_IS_QUOTED(type) (!AKL_IS_IMMEDIATE(type) && (type)->is_quoted)
 #define AKL_IS_TRUE(type)   (!AKL_IS_NIL(type))
 /*
  * This section contains the most important data structures
  * for the mark-and-sweep garbage collector.
  */
-/* Size of the GC pools, must be the power of 2 */
-#define AKL_GC_POOL_SIZE 64
+/* Size of the GC pools in bytes (with the header), the requested size
+   is rounded up to a power of 2 between the minimum and maximum */
+#ifndef AKL_GC_POOL_BYTES
+# define AKL_GC_POOL_BYTES (64*1024)
+#endif
+#define AKL_GC_POOL_MIN_BYTES (4*1024)
+#define AKL_GC_POOL_MAX_BYTES (2*1024*1024)
+/* Pools from this size are aligned to it and backed by huge pages */
+#define AKL_GC_HUGE_PAGE_BYTES (2*1024*1024)
 #define AKL_GC_DEFINE_OBJ       struct akl_gc_object gc_obj
 #define AKL_GC_SET_MARK(obj, m) ((obj)->gc_obj.gc_mark = m)
 #define AKL_GC_SET_VALUE_LIST(obj) ((obj)->gc_obj.gc_le_is_obj = TRUE)
@@ -151,7 +161,22 @@ typedef int (*akl_cmp_fn_t)(void *, void *);
 #define AKL_GC_SET_STATIC(obj)  ((obj)->gc_obj.gc_static = TRUE)
 #define AKL_GC_INIT_OBJ(obj, id) \
     (obj)->gc_obj.gc_type_id = id; (obj)->gc_obj.gc_static = FALSE; \
-    (obj)->gc_obj.gc_mark = FALSE ; (obj)->gc_obj.gc_le_is_obj = FALSE;
+    (obj)->gc_obj.gc_mark = FALSE ; (obj)->gc_obj.gc_le_is_obj = FALSE; \
+    (obj)->gc_obj.gc_remembered = FALSE;
+/* Must be used, when a reference is stored into an existing object.
+   The marked (old) objects are remembered for the next minor collection,
+   since they can point to young objects from now on. */
+#define AKL_GC_WRITE_BARRIER(s, obj) \
+    do { if (AKL_GC_IS_MARKED(obj) && !(obj)->gc_obj.gc_remembered) \
+            akl_gc_remember((s), (obj)); } while (0)
+/* Must be used, when a new entry is linked from a list header or from
+   an other entry (obj). The sublists (see akl_cdr()) share the entries,
+   so a young header can have old entries. If obj is marked, the new
+   entry is marked and remembered itself, so only its value is visited
+   again (and not the whole list). */
+#define AKL_GC_LIST_BARRIER(s, obj, ent) \
+    do { if (AKL_GC_IS_MARKED(obj)) { AKL_GC_SET_MARK(ent, TRUE); \
+            AKL_GC_WRITE_BARRIER(s, ent); } } while (0)
 
 /* GC'd object's finalizer */
 typedef void (*akl_gc_destructor_t)(struct akl_state *, void *obj);
@@ -169,6 +194,8 @@ struct akl_gc_object {
      * for akl_list_entry structures) */
     bool_t              gc_le_is_obj : 1;
     bool_t              gc_static    : 1;
+    /* Is the object in the remembered set? */
+    bool_t              gc_remembered : 1;
 };
 
 /* Just used for conversion purposes */
@@ -196,6 +223,7 @@ struct akl_list {
 };
 
 struct akl_userdata {
+    AKL_GC_DEFINE_OBJ;
     unsigned int ud_id;      /* Exact user type identifer */
     void        *ud_private; /* Arbitrary userdata */
 };
@@ -224,14 +252,74 @@ extern struct akl_value {
 } NIL_VALUE, TRUE_VALUE;
 #define AKL_NIL &NIL_VALUE
 #define AKL_TRUE &TRUE_VALUE
+/* Immediate values have no lexical information */
+#define AKL_LEX_INFO(value) (AKL_IS_IMMEDIATE(value) ? NULL : (value)->va_lex_info)
+
+/*
+ * Immediate numbers: On 64 bit systems most of the doubles are
+ * stored in the value pointer itself, so the arithmetic does not
+ * allocate anything. The bits of the double are rotated, so the
+ * sign and the two highest bits of the exponent go to the bottom,
+ * and the lowest two bits are set to 0x2 (the heap values are always
+ * aligned, so their lowest bits are zero). Only the doubles with an
+ * magnitude between 2^-255 and 2^257 (and the zero) can be encoded this
+ * way, the others are boxed as before.
+ * Define AKL_NO_IMMEDIATES to box every number.
+ */
+#if !defined(AKL_NO_IMMEDIATES) && UINTPTR_MAX == 0xffffffffffffffffULL
+# define AKL_IMMEDIATE_NUMBERS
+#endif
+
+#ifdef AKL_IMMEDIATE_NUMBERS
+#define AKL_IMMEDIATE_TAG  0x02
+#define AKL_IMMEDIATE_ZERO 0x8000000000000002ULL
+#define AKL_IS_IMMEDIATE(value) (((uintptr_t)(value) & 0x03) == AKL_IMMEDIATE_TAG)
+
+union akl_double_bits {
+    double   db_number;
+    uint64_t db_bits;
+};
+
+/* Returns NULL, if the number cannot be represented as an immediate */
+static inline struct akl_value *akl_number_to_immediate(double num)
+{
+    union akl_double_bits b;
+    unsigned int exp;
+    b.db_number = num;
+    exp = (unsigned int)(b.db_bits >> 60) & 0x07;
+    if (b.db_bits != 0x3000000000000000ULL && (exp == 3 || exp == 4))
+        return (struct akl_value *)(uintptr_t)
+            ((((b.db_bits << 3) | (b.db_bits >> 61)) & ~(uint64_t)0x01)
+            | AKL_IMMEDIATE_TAG);
+    else if (b.db_bits == 0)
+        return (struct akl_value *)(uintptr_t)AKL_IMMEDIATE_ZERO;
+    return NULL;
+}
+
+static inline double akl_immediate_to_number(const struct akl_value *value)
+{
+    union akl_double_bits b;
+    uint64_t v = (uint64_t)(uintptr_t)value;
+    if (v == AKL_IMMEDIATE_ZERO)
+        return 0.0;
+    v = (2 - (v >> 63)) | (v & ~(uint64_t)0x03);
+    b.db_bits = (v >> 3) | (v << 61);
+    return b.db_number;
+}
+#else
+#define AKL_IS_IMMEDIATE(value) (0)
+#define akl_immediate_to_number(value) (0.0)
+#endif // AKL_IMMEDIATE_NUMBERS
 
 struct akl_symbol {
     char                   *sb_name;
     /* Symbols only exist in one instance and
-     * only in the symbol tree.
+     * only in the symbol table.
      * You can simply compare two symbols by their pointers.
      */
-    RB_ENTRY(akl_symbol)    sb_entry;
+    unsigned int            sb_hash;  /* Hash of the (case insensitive) name */
+    /* The global binding slot of the symbol (see akl_get_var_slot()) */
+    struct akl_variable    *sb_var;
     /* We must know the the constness of the name. */
     bool_t                  sb_is_cdef : 1;
 };
@@ -239,6 +327,16 @@ struct akl_symbol {
 struct akl_symbol *akl_new_symbol(struct akl_state *, char *, bool_t);
 struct akl_symbol *akl_get_symbol(struct akl_state *s, char *name);
 struct akl_symbol *akl_get_or_create_symbol(struct akl_state *s, char *name);
+struct akl_symbol *akl_next_symbol(struct akl_state *, unsigned int *);
+unsigned int akl_hash_name(const char *);
+
+/* Open addressing (linear probing) hash table of the interned symbols */
+#define AKL_SYMTAB_DEFSIZE 1024 /* Must be a power of two */
+struct akl_symbol_table {
+    struct akl_symbol **st_slots;
+    unsigned int        st_size;  /* Count of the slots */
+    unsigned int        st_count; /* Count of the symbols */
+};
 
 struct akl_variable {
     AKL_GC_DEFINE_OBJ;
@@ -249,6 +347,7 @@ struct akl_variable {
     char                   *vr_desc;          /* Documentation (mostly functions) */
     bool_t                  vr_is_cdesc : 1;  /* True when vr_desc is const char */
     bool_t                  vr_is_const : 1;  /* True on immutable "variables" */
+    unsigned int            vr_version;       /* Incremented on every rebinding (see inline caches) */
 };
 
 /* To properly handle both file and string sources, we
@@ -271,9 +370,13 @@ struct akl_io_device {
     akl_token_t       iod_backlog; /* akl_lex_putback() will put the token to here */
 };
 
-/* Stack frame information */
+/* Stack frame information: The arguments of the called
+   function are in the stack, from fr_base to fr_base+fr_count. */
 struct akl_frame {
-    struct akl_list_entry *ent;
+    unsigned int fr_bottom; /* Stack index of the first argument */
+    unsigned int fr_base;   /* First argument, which is not shifted yet */
+    unsigned int fr_count;  /* Count of the remaining arguments */
+    unsigned int fr_locals; /* Count of the local variable slots (above the arguments) */
 };
 
 void akl_init_frame(struct akl_context *, int argc);
@@ -282,15 +385,19 @@ void akl_init_frame(struct akl_context *, int argc);
 struct akl_context {
     /* Current context for different entities */
     struct akl_state        *cx_state;     /* Current state */
-    struct akl_list         *cx_stack;     /* Pointer to the current stack (probably '&cx_state->ai_stack') */
-    struct akl_list         *cx_ir;        /* The current Internal Representation */
+    struct akl_vector       *cx_stack;     /* Pointer to the current stack (array of value pointers) */
+    struct akl_vector       *cx_ir;        /* The current Internal Representation */
     struct akl_function     *cx_func;      /* The called function's descriptor */
     struct akl_context      *cx_parent;    /* Parent context pointer */
-    struct akl_list         *cx_frame;     /* Frame info used by executor (push) */
+    struct akl_frame         cx_frame;     /* Frame info used by executor (push) */
     unsigned int             cx_frame_len; /* Length of the frame */
+    unsigned int             cx_ip;        /* Return address in cx_ir, while calling */
+    double                   cx_number;    /* Unboxed immediate for akl_frame_*_number() */
 
     const char           *cx_func_name; /* The called function's name */
     struct akl_function  *cx_comp_func; /* The function under compilation */
+    bool_t                cx_is_tail;   /* The next compiled form is in tail position */
+    bool_t                cx_is_toplevel; /* The next compiled form is a top level one */
     struct akl_io_device *cx_dev;       /* The current I/O device */
     struct akl_lex_info  *cx_lex_info;  /* Current lexical information */
     struct akl_function  *cx_fn_main;   /* The main function */
@@ -328,6 +435,7 @@ struct akl_fun_decl {
     } fd_fun;
     const char *fd_name;
     const char *fd_desc;
+    bool_t      fd_is_pure; /* No side effects, the compiler can fold it */
 };
 
 typedef int (*akl_mod_load_t)(struct akl_state *);
@@ -365,6 +473,7 @@ struct akl_module __module_desc = { \
 #define AKL_MOD_AUTHOR(name)      .am_author = (name)
 
 #define AKL_VECTOR_DEFSIZE 10
+#define AKL_STACK_DEFSIZE 256
 #define AKL_VECTOR_NEW(s, type, count) akl_vector_new(s, sizeof(type), count)
 #define AKL_VECTOR_FOREACH(ind, ptr, vec)            \
     for ( (ind) = 0, (ptr) = akl_vector_at(vec, 0)   \
@@ -410,23 +519,55 @@ void         akl_vector_free(struct akl_state *, struct akl_vector *);
 void         akl_vector_grow(struct akl_vector *, unsigned int);
 void         akl_vector_truncate_by(struct akl_vector *, unsigned int);
 
+/* A variable of the enclosing function, which is used by a lambda.
+   It is copied to the closure, when the lambda is evaluated. */
+struct akl_capture {
+    struct akl_symbol   *cp_name;
+    /* Where it is in the enclosing function: AKL_IR_LOAD (argument),
+       AKL_IR_LOCAL_GET (local) or AKL_IR_CAPTURE_LOAD (captured) */
+    int                  cp_op;
+    unsigned int         cp_ind;
+};
+
+/* Source of a function body, which is compiled at its first call */
+struct akl_lazy_body {
+    const char  *lb_file;   /* Name of the source file */
+    long         lb_offset; /* Offset of the body's left brace */
+    unsigned int lb_line;   /* Position of the body (for the errors) */
+    unsigned int lb_column;
+    unsigned int lb_defun_line; /* Position of the defun! form */
+    unsigned int lb_defun_column;
+};
+
 struct akl_lisp_fun {
     /* Name of the arguments */
     //char               **uf_args;
     struct akl_vector    uf_args;
-    /* Name of the local variables */
-    /* TODO: struct akl_vector   uf_locals; */
-    /* List of the instructions,
-        (li_parent is the full IR) */
-    struct akl_list      uf_body;
+    /* Name of the local variables in the current scope (only used
+       by the compiler), the index is the slot of the variable */
+    struct akl_vector    uf_locals;
+    /* Count of the local variable slots in the frame */
+    unsigned int         uf_nlocals;
+    /* Captured variables (struct akl_capture), for lambdas */
+    struct akl_vector    uf_captures;
+    /* The enclosing function (only used by the compiler) */
+    struct akl_function *uf_outer;
+    /* Array of the instructions (struct akl_ir_instruction),
+       the labels are offsets in this array */
+    struct akl_vector    uf_body;
     /* Start of the function */
     struct akl_list      uf_labels;
     struct akl_lex_info *uf_info;
+    /* Not compiled body (lazy-compile), NULL if uf_body is ready */
+    struct akl_lazy_body *uf_lazy;
 };
 
 struct akl_function {
     AKL_GC_DEFINE_OBJ;
     enum AKL_FUNCTION_TYPE fn_type;
+    bool_t                 fn_is_pure : 1; /* See akl_fun_decl */
+    /* Values of the captured variables of a closure (see uf_captures) */
+    struct akl_value     **fn_captures;
     /* Body of the function */
     union {
         /* Bytecode lisp function */
@@ -452,24 +593,71 @@ struct akl_value *
 akl_call_function(struct akl_context *, struct akl_context *, const char *, int);
 struct akl_context *
 akl_bound_function(struct akl_context *, struct akl_symbol *, struct akl_function *);
+void akl_release_context(struct akl_context *);
+
+/* A nursery pool is promoted, if its survivors use this percent of
+   its slots, the sparse ones are kept in the nursery (see gc.c) */
+#ifndef AKL_GC_PROMOTE_PERCENT
+# define AKL_GC_PROMOTE_PERCENT 50
+#endif
 
+/* The header of a pool is at the start of its pages,
+   the bitmap and the slots of the objects are after it */
 struct akl_gc_pool {
-    struct akl_vector    gp_pool;
     struct akl_gc_pool  *gp_next;
-    /* Bitmap of the free slots */
-    unsigned int         gp_freemap[AKL_GC_POOL_SIZE/(sizeof(unsigned int)*8)];
+    char                *gp_objects; /* The first slot */
+    size_t               gp_objsize;
+    size_t               gp_bytes;   /* Size of the pages */
+    unsigned int         gp_size;    /* Count of the slots */
+    unsigned int         gp_count;   /* Count of the used slots */
+    /* The next slot to try, when the pool is in the nursery */
+    unsigned int         gp_top;
+    /* The old objects of a nursery pool (the survivors, which were kept) */
+    unsigned int         gp_old;
+    /* The free slots are not before this word of the bitmap */
+    unsigned int         gp_free_word;
+    /* The old pools with free slots are also in the free list of the type */
+    struct akl_gc_pool  *gp_free_next;
+    struct akl_gc_pool  *gp_free_prev;
+    bool_t               gp_in_free :1;
+    /* Bitmap of the used slots (the bits after the last slot are set) */
+    unsigned int         gp_freemap[];
 };
+#define AKL_GC_POOL_AT(p, i) \
+    ((void *)((p)->gp_objects + (size_t)(i)*(p)->gp_objsize))
 
 struct akl_gc_type {
     akl_gc_type_t       gt_type_id;
     size_t              gt_type_size;
+    size_t              gt_pool_bytes;
+    unsigned int        gt_pool_slots;
     akl_gc_marker_t     gt_marker_fn;
+    /* Frees the memory of a dead object outside of the pools (or NULL) */
+    akl_gc_destructor_t gt_destructor_fn;
 
     struct akl_gc_pool *gt_pool_last;
     unsigned int        gt_pool_count;
     struct akl_gc_pool *gt_pool_head;
+    /* The old pools, which have free slots (used without gen-gc) */
+    struct akl_gc_pool *gt_free;
+    /* The young generation: The objects are allocated from the
+       current pool (gt_nursery_cur), the pools after it are not used
+       since the last minor collection. The kept pools are the first. */
+    struct akl_gc_pool *gt_nursery;
+    struct akl_gc_pool *gt_nursery_cur;
+    /* The next pool to clear or sweep by the incremental collection */
+    struct akl_gc_pool *gt_sweep;
+    struct akl_gc_pool *gt_sweep_prev;
 };
 
+/* Phases of the incremental collection (see akl_gc_step()) */
+typedef enum {
+    AKL_GC_PHASE_IDLE = 0,
+    AKL_GC_PHASE_CLEAR,   /* Clearing the marks of the old pools */
+    AKL_GC_PHASE_MARK,    /* Scanning the gray objects */
+    AKL_GC_PHASE_SWEEP    /* Sweeping the old pools */
+} akl_gc_phase_t;
+
 /*
  * Usage:
  * AKL_DEFINE_FUNCTION(testfn, ctx, argc) {
@@ -495,6 +683,7 @@ int akl_get_args(struct akl_context *, int, ...);
 */
 int akl_get_args_strict(struct akl_context *, int argc, ...);
 struct akl_value *akl_frame_pop(struct akl_context *);
+/* The returned pointer is only valid until the next call */
 double *akl_frame_pop_number(struct akl_context *);
 double *akl_frame_shift_number(struct akl_context *);
 char   *akl_frame_pop_string(struct akl_context *);
@@ -535,45 +724,91 @@ struct akl_mem_callbacks {
     akl_nomem_action_t (*mc_nomem_fn)(struct akl_state *);
 };
 
-struct akl_mem_callbacks akl_mem_std_callbacks;
+extern struct akl_mem_callbacks akl_mem_std_callbacks;
 void   akl_set_mem_callbacks(struct akl_state *, const struct akl_mem_callbacks *);
 
 /* An instance of the interpreter */
 struct akl_state {
     const struct akl_mem_callbacks *ai_mem_fn;
     struct akl_io_device           *ai_device;
-    RB_HEAD(SYM_TREE, akl_symbol)   ai_symbols;
+    struct akl_symbol_table         ai_symbols;
     RB_HEAD(VAR_TREE, akl_variable) ai_global_vars;
     unsigned int                    ai_gc_malloc_size; /* Totally malloc()'d bytes */
     struct akl_vector               ai_gc_types;
+    /* Bytes of the GC objects allocated since the last collection,
+       the executor collects, when it reaches ai_gc_threshold */
+    unsigned long                   ai_gc_allocated;
+#ifndef AKL_GC_THRESHOLD
+# define AKL_GC_THRESHOLD (4*1024*1024)
+#endif
+    unsigned long                   ai_gc_threshold;
+    /* Bytes of the pools promoted by the minor collections, a full
+       collection is done, when it reaches ai_gc_major_threshold */
+    unsigned long                   ai_gc_promoted;
+#ifndef AKL_GC_MAJOR_THRESHOLD
+# define AKL_GC_MAJOR_THRESHOLD (4*AKL_GC_THRESHOLD)
+#endif
+    unsigned long                   ai_gc_major_threshold;
+    unsigned long                   ai_gc_collections; /* Full collections */
+    unsigned long                   ai_gc_minors;      /* Minor collections */
+    unsigned long                   ai_gc_minor_time;  /* Pauses (in usecs) */
+    unsigned long                   ai_gc_minor_max;
+    unsigned long                   ai_gc_full_time;   /* Stop-the-world */
+    unsigned long                   ai_gc_full_max;
+    /* Old objects, which can point to young ones */
+    struct akl_vector               ai_gc_remembered;
+    /* The incremental collection: Marked objects with unscanned
+       references, the position of the clear and sweep phases */
+    akl_gc_phase_t                  ai_gc_phase;
+    struct akl_vector               ai_gc_gray;
+    unsigned int                    ai_gc_cursor_type;
+    unsigned long                   ai_gc_work;  /* Work done in the slice */
+#ifndef AKL_GC_SLICE_OBJECTS
+# define AKL_GC_SLICE_OBJECTS 1000
+#endif
+    unsigned long                   ai_gc_slice_objects; /* Budget of a slice */
+    unsigned long                   ai_gc_slice_usecs;
+    unsigned long                   ai_gc_slices;
+    unsigned long                   ai_gc_slice_max;
 
     /* Loaded user-defined types */
     struct akl_vector               ai_utypes;
     /* Currently loaded modules */
     struct akl_list                 ai_modules;
     struct akl_context              ai_context;   /* The main context  */
-    struct akl_list                 ai_stack;     /* The main stack list */
+    struct akl_vector               ai_stack;     /* The main stack */
+    /* Preallocated contexts of the called functions */
+#ifndef AKL_CALL_STACK_SIZE
+# define AKL_CALL_STACK_SIZE 4096
+#endif
+    struct akl_context             *ai_call_stack;
+    unsigned int                    ai_call_depth; /* Count of the used contexts */
+    unsigned long                   ai_ic_hits;    /* Inline cache statistics */
+    unsigned long                   ai_ic_misses;
     struct akl_list                *ai_errors;    /* Collection of the errors (if any, default NULL) */
     #define AKL_CFG_USE_COLORS      0x0001
     #define AKL_CFG_USE_GC          0x0002
     #define AKL_CFG_INTERACTIVE     0x0004               /* Interactive interpreter */
     #define AKL_DEBUG_INSTR         0x0008
     #define AKL_DEBUG_STACK         0x0010
+    #define AKL_CFG_OPTIMIZE        0x0020               /* Peephole optimization of the IR */
+    #define AKL_CFG_LAZY_COMPILE    0x0040               /* Compile the functions at their first call */
+    #define AKL_CFG_GEN_GC          0x0080               /* Allocate in the nursery, minor collections */
+    #define AKL_CFG_INCR_GC         0x0100               /* Full collections in slices */
     unsigned long                   ai_config; /* Bit configuration */
-    bool_t                          ai_gc_last_was_mark : 1;
     bool_t                          ai_interrupted :1;  /* The program is stopped by an interrupt  */
 };
 
 bool_t akl_set_feature(struct akl_state *, const char *);
 bool_t akl_set_feature_to(struct akl_state *, const char *, bool_t);
+bool_t akl_set_setting(struct akl_state *, const char *, unsigned long);
 
 struct akl_label *akl_new_branches(struct akl_state *, struct akl_context *);
 struct akl_list  *akl_new_labels(struct akl_context *, int *, int);
 struct akl_label *akl_new_label(struct akl_context *);
 
 struct akl_label {
-    struct akl_list       *la_ir;
-    struct akl_list_entry *la_branch;
+    unsigned int           la_branch; /* Offset of the labeled instruction */
     unsigned               la_ind;
     char                  *la_name; // Only used when assembling
 };
@@ -591,10 +826,35 @@ typedef enum {
     AKL_IR_JN,     /* Jump if false, (not true, nil) */
     AKL_IR_HEAD,
     AKL_IR_TAIL,
-    AKL_IR_RET
+    AKL_IR_RET,
+    /* Numeric builtins (with a fallback to the generic call) */
+    AKL_IR_ADD,
+    AKL_IR_SUB,
+    AKL_IR_MUL,
+    AKL_IR_DIV,
+    AKL_IR_LT,
+    AKL_IR_GT,
+    AKL_IR_EQ,
+    AKL_IR_INC,
+    AKL_IR_DEC,
+    /* Superinstructions (built by the optimizer) */
+    AKL_IR_LOAD2,  /* Two loads */
+    AKL_IR_TAILCALL, /* Call, which replaces the current function */
+    /* Local variables (slots above the arguments) */
+    AKL_IR_LOCAL_GET,
+    AKL_IR_LOCAL_SET,
+    /* Closures */
+    AKL_IR_CAPTURE_LOAD, /* Push a captured variable of the current function */
+    AKL_IR_CLOSURE,      /* Make a closure from the function and the captured values */
+    AKL_IR_SWITCH,       /* Jump by the value, with a jump table (case) */
+    /* Loops */
+    AKL_IR_POP,          /* Drop the top of the stack */
+    AKL_IR_LIST_ITER,    /* Replace the list with an iterator (dolist) */
+    AKL_IR_LIST_NEXT,    /* Push the next element, or jump at the end */
+    AKL_IR_NUMBER_CHECK  /* The top of the stack must be a number (dotimes) */
 } akl_ir_instruction_t;
 
-#define AKL_NR_INSTRUCTIONS 14
+#define AKL_NR_INSTRUCTIONS 34
 const char *akl_ir_instruction_set[AKL_NR_INSTRUCTIONS];
 
 typedef enum {
@@ -603,35 +863,96 @@ typedef enum {
     AKL_JMP_FALSE = AKL_IR_JN
 } akl_jump_t;
 
+/* A key of the SWITCH instruction: an integer number or a symbol */
+struct akl_switch_entry {
+    struct akl_symbol       *se_sym;   /* NULL for numbers */
+    long                     se_num;
+    struct akl_label        *se_label;
+};
+
+/* Jump table of the SWITCH instruction */
+struct akl_switch {
+    /* Dense integer keys: sw_table[key - sw_min] (NULL, if not a key) */
+    long                     sw_min;
+    unsigned long            sw_range;
+    struct akl_label       **sw_table;
+    /* Symbols and the sparse integer keys: open addressing hash
+       on the symbol pointer (or the number) */
+    struct akl_switch_entry *sw_hash;
+    unsigned int             sw_hash_size; /* Power of 2 (or 0) */
+    struct akl_label        *sw_default;
+    /* All of the keys (struct akl_switch_entry) */
+    struct akl_vector        sw_keys;
+};
+
+static inline unsigned int
+akl_switch_hash(struct akl_symbol *sym, long num)
+{
+    uint64_t k = (sym != NULL) ? (uint64_t)((uintptr_t)sym >> 3) : (uint64_t)num;
+    return (unsigned int)((k * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
 struct akl_ir_instruction {
     akl_ir_instruction_t     in_op;  /* Operation */
-    /* Optional (used if the function already resolved) */
+    /* Address of the handler code (only used with AKL_THREADED_CODE) */
+    void                    *in_handler;
+    /* The called function. For calls by symbol, this is an inline
+       cache, valid while in_cvar has the version in_cver. */
     struct akl_function     *in_fun;
+    struct akl_variable     *in_cvar;
+    unsigned int             in_cver;
     union {
         struct akl_value    *value;  /* Generic value (mostly used by push) */
         struct akl_symbol   *symbol; /* Name of the variable of function    */
         struct akl_label    *label;  /* Label for the next instruction      */
         unsigned int         ui_num; /* Stack pointer or argument count     */
+        struct akl_variable *var;    /* Global variable slot (get and set)  */
+        struct akl_switch   *swtch;  /* Jump table (switch)                 */
     } in_arg[2];
     struct akl_lex_info     *in_linfo; /* Lexical information of this instruction */
 };
 
 struct akl_function *akl_compile_list(struct akl_context *);
+void akl_ir_finalize(struct akl_context *);
+void akl_ir_optimize(struct akl_state *, struct akl_lisp_fun *);
+void akl_ir_resolve(struct akl_vector *);
 void akl_build_branch(struct akl_context *, struct akl_list *, int, int);
 void akl_build_jump(struct akl_context *, akl_jump_t, struct akl_list *, int);
 /* Call by symbol or function */
 void akl_build_call(struct akl_context *, struct akl_symbol *, struct akl_function *, int);
+void akl_build_tailcall(struct akl_context *, struct akl_symbol *, struct akl_function *, int);
+/* Instruction of a builtin function (AKL_IR_NOP if it has not any) */
+akl_ir_instruction_t akl_builtin_instruction(struct akl_function *, int);
 void akl_build_label(struct akl_context *, struct akl_list *, int);
 void akl_build_set(struct akl_context *, struct akl_symbol *);
 void akl_build_get(struct akl_context *, struct akl_symbol *);
 void akl_build_load(struct akl_context *, struct akl_symbol *);
+/* Local variables of the currently compiled function */
+int  akl_local_finder(struct akl_lisp_fun *, struct akl_symbol *);
+bool_t akl_outer_finder(struct akl_function *, struct akl_symbol *);
+unsigned int akl_new_local(struct akl_context *, struct akl_symbol *);
+void akl_build_local_get(struct akl_context *, unsigned int);
+void akl_build_local_set(struct akl_context *, unsigned int, bool_t);
+/* Push a function value (make a closure, if it captures variables) */
+void akl_build_function(struct akl_context *, struct akl_function *);
+/* Jump by the popped value. The keys are only known after the code of
+   the branches, the table is made by akl_finish_switch() (the keys are
+   a vector of struct akl_switch_entry, taken by the table). */
+unsigned int akl_build_switch(struct akl_context *);
+void akl_finish_switch(struct akl_context *, unsigned int, struct akl_vector *
+                       , struct akl_label *);
 void akl_build_push(struct akl_context *, struct akl_value *);
 void akl_build_nop(struct akl_context *);
 void akl_build_ret(struct akl_context *);
+void akl_build_pop(struct akl_context *);
+void akl_build_list_iter(struct akl_context *);
+void akl_build_number_check(struct akl_context *);
+/* The iterator is in the given local slot */
+void akl_build_list_next(struct akl_context *, unsigned int, struct akl_list *, int);
 /* Helper functions for the Red-Black trees */
 
 /* Order symbols by name.
- * XXX: Used by the tree builder functions.
+ * XXX: Used by the variable tree.
 */
 static inline int
 akl_rb_cmp_sym(struct akl_symbol *f, struct akl_symbol *s)
@@ -649,7 +970,6 @@ akl_rb_cmp_var(struct akl_variable *f, struct akl_variable *s)
 
 /* Generate prototypes for the Red-Black trees */
 RB_PROTOTYPE(VAR_TREE, akl_variable, vr_entry, akl_rb_cmp_var);
-RB_PROTOTYPE(SYM_TREE, akl_symbol,   sb_entry, akl_rb_cmp_sym);
 
 struct akl_variable *akl_set_global_var(struct akl_state *s, struct akl_symbol *
                         , char *desc, bool_t is_cdesc
@@ -658,7 +978,12 @@ struct akl_variable *akl_set_global_variable(struct akl_state *s
                         , char *name, bool_t is_cname
                         , char *desc, bool_t is_cdesc
                         , struct akl_value *v);
-void   akl_add_global_cfun(struct akl_state *, akl_cfun_t, const char *, const char *);
+struct akl_variable *akl_get_var_slot(struct akl_state *, struct akl_symbol *);
+struct akl_variable *akl_bind_var(struct akl_state *, struct akl_variable *
+                        , char *desc, bool_t is_cdesc
+                        , struct akl_value *v);
+struct akl_function *
+       akl_add_global_cfun(struct akl_state *, akl_cfun_t, const char *, const char *);
 void   akl_add_global_sfun(struct akl_state *, akl_sfun_t, const char *, const char *);
 void   akl_remove_function(struct akl_state *, akl_cfun_t);
 struct akl_variable *
@@ -758,6 +1083,10 @@ double  akl_lex_get_number(struct akl_io_device *);
 struct akl_symbol *akl_lex_get_symbol(struct akl_io_device *);
 
 akl_token_t akl_compile_next(struct akl_context *, struct akl_function **fn);
+bool_t akl_lex_skip_list(struct akl_io_device *);
+/* Lazy compilation of function bodies */
+bool_t akl_compile_defer(struct akl_context *, struct akl_function *);
+void   akl_compile_lazy(struct akl_context *, struct akl_function *);
 struct akl_value *
 akl_parse_token(struct akl_context *, akl_token_t, bool_t);
 struct akl_list  *akl_parse_list(struct akl_context *);
@@ -785,6 +1114,9 @@ void akl_asm_parse_decl(struct akl_context *);
 void                   akl_init_state(struct akl_state *, const struct akl_mem_callbacks *);
 struct akl_state      *akl_new_state(const struct akl_mem_callbacks *);
 struct akl_function   *akl_new_function(struct akl_state *);
+struct akl_function   *akl_new_closure(struct akl_state *, struct akl_function *
+                                       , struct akl_value **);
+void                   akl_init_lisp_fun(struct akl_state *, struct akl_lisp_fun *);
 struct akl_value      *akl_new_function_value(struct akl_state *, struct akl_function *);
 void                   akl_init_list(struct akl_list *);
 struct akl_list       *akl_new_list(struct akl_state *);
@@ -796,6 +1128,8 @@ struct akl_value      *akl_new_nil_value(struct akl_state *s);
 struct akl_value      *akl_new_true_value(struct akl_state *s);
 struct akl_value      *akl_new_string_value(struct akl_state *, char *);
 struct akl_value      *akl_new_number_value(struct akl_state *, double);
+/* Always allocates the number on the heap (e.g.: for literals) */
+struct akl_value      *akl_new_boxed_number_value(struct akl_state *, double);
 struct akl_value      *akl_new_list_value(struct akl_state *, struct akl_list *);
 struct akl_value      *akl_new_symbol_value(struct akl_state *, char *, bool_t);
 struct akl_value      *akl_new_sym_value(struct akl_state *, struct akl_symbol *);
@@ -811,11 +1145,14 @@ struct akl_lex_info   *akl_new_lex_info(struct akl_state *, struct akl_io_device
 
 /* GC functions */
 void   akl_gc_init(struct akl_state *);
-akl_gc_type_t akl_gc_register_type(struct akl_state *, akl_gc_marker_t, size_t);
+akl_gc_type_t akl_gc_register_type(struct akl_state *, akl_gc_marker_t, size_t, size_t);
 //void akl_gc_deregister_type(struct akl_state *, akl_gc_type_t);
 struct akl_gc_type *akl_gc_get_type(struct akl_state *, akl_gc_type_t);
 
 void   akl_gc_mark(struct akl_state *);
+void   akl_gc_unmark_all(struct akl_state *);
+void   akl_gc_collect(struct akl_context *);
+void   akl_gc_remember(struct akl_state *, void *);
 void   akl_gc_mark_object(struct akl_state *, void *, bool_t);
 void   akl_gc_sweep_pool(struct akl_state *, struct akl_gc_pool *, akl_gc_marker_t);
 void   akl_gc_sweep(struct akl_state *);
@@ -936,6 +1273,8 @@ char *akl_get_module_path(struct akl_state *, const char *);
 void akl_module_free(struct akl_state *, struct akl_module *);
 struct akl_module *akl_load_module_desc(struct akl_state *, char *);
 void akl_free_module(struct akl_state *, struct akl_module *);
+void *akl_alloc_pages(struct akl_state *, size_t);
+void akl_free_pages(struct akl_state *, void *, size_t);
 
 
 #ifndef AKL_CFUN_PREFIX
@@ -956,15 +1295,17 @@ void akl_free_module(struct akl_state *, struct akl_module *);
     struct akl_value * AKL_CAT(AKL_CFUN_PREFIX, fname)(struct akl_context * ctx, int argc)
 
 #define AKL_DEFINE_SFUN(fname, ctx) \
-    struct akl_value * AKL_CAT(AKL_SFUN_PREFIX, fname)(struct akl_context * ctx)
+    struct akl_function * AKL_CAT(AKL_SFUN_PREFIX, fname)(struct akl_context * ctx)
 
 #define AKL_DECLARE_FUNS(vname) \
     static const struct akl_fun_decl vname[] =
 
-#define AKL_FUN(cfun, name, desc) { AKL_FUNC_CFUN, { AKL_CAT(AKL_CFUN_PREFIX, cfun) }, name, desc }
-#define AKL_NE_FUN(cfun, name, desc) { AKL_FUNC_NOEVAL, { AKL_CAT(AKL_CFUN_PREFIX, cfun) }, name, desc }
-#define AKL_SFUN(scfun, name, desc) { AKL_FUNC_SPECIAL, { (akl_cfun_t)AKL_CAT(AKL_SFUN_PREFIX, scfun) }, name, desc }
-#define AKL_END_FUNS() { 0, { NULL }, NULL, NULL }
+#define AKL_FUN(cfun, name, desc) { AKL_FUNC_CFUN, { AKL_CAT(AKL_CFUN_PREFIX, cfun) }, name, desc, FALSE }
+/* The result only depends on the arguments (no side effects) */
+#define AKL_PURE_FUN(cfun, name, desc) { AKL_FUNC_CFUN, { AKL_CAT(AKL_CFUN_PREFIX, cfun) }, name, desc, TRUE }
+#define AKL_NE_FUN(cfun, name, desc) { AKL_FUNC_NOEVAL, { AKL_CAT(AKL_CFUN_PREFIX, cfun) }, name, desc, FALSE }
+#define AKL_SFUN(scfun, name, desc) { AKL_FUNC_SPECIAL, { (akl_cfun_t)AKL_CAT(AKL_SFUN_PREFIX, scfun) }, name, desc, FALSE }
+#define AKL_END_FUNS() { 0, { NULL }, NULL, NULL, FALSE }
 
 #if USE_COLORS
 #define AKL_GREEN  "\x1b[32m"
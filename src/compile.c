@@ -22,16 +22,20 @@
  ************************************************************************/
 #include "aklisp.h"
 #include <stdint.h>
+#include <limits.h>
 
+/* Set the lexical information of the last built instruction */
 static void
 akl_ir_set_lex_info(struct akl_context *ctx, struct akl_lex_info *info)
 {
     AKL_ASSERT(ctx && ctx->cx_ir, AKL_NOTHING);
-    struct akl_ir_instruction *li =
-            (struct akl_ir_instruction *)akl_list_last(ctx->cx_ir);
-    if (li && info) {
-        li->in_linfo = info;
-    }
+    unsigned int cnt = akl_vector_count(ctx->cx_ir);
+    struct akl_ir_instruction *li;
+    if (cnt == 0 || info == NULL)
+        return;
+
+    li = (struct akl_ir_instruction *)akl_vector_at(ctx->cx_ir, cnt-1);
+    li->in_linfo = info;
 }
 
 static int
@@ -48,53 +52,289 @@ argument_finder(struct akl_lisp_fun *fn, struct akl_symbol *sym)
     return i;
 }
 
-static struct akl_ir_instruction *
-new_instr(struct akl_context *ctx)
+/* Slot of the local variable in the current scope (the innermost
+   one, if it is shadowed), or -1 */
+int
+akl_local_finder(struct akl_lisp_fun *fn, struct akl_symbol *sym)
 {
-    struct akl_state *s = ctx->cx_state;
-    struct akl_list *ir = ctx->cx_ir;
-    struct akl_ir_instruction *nop = AKL_MALLOC(s, struct akl_ir_instruction);
-    nop->in_op    = AKL_IR_NOP;
-    nop->in_linfo = NULL;
-    nop->in_fun   = NULL;
-    return nop;
+    struct akl_symbol **names = (struct akl_symbol **)akl_vector_first(&fn->uf_locals);
+    int i = akl_vector_count(&fn->uf_locals);
+    while (i-- > 0) {
+        if (names[i] == sym)
+            return i;
+    }
+    return -1;
 }
 
-static struct akl_ir_instruction *
-create_or_get_instr(struct akl_context *ctx)
+/* Gives TRUE, if the variable belongs to an enclosing function of
+   the lambda (it is captured as a copy, so it cannot be set) */
+bool_t
+akl_outer_finder(struct akl_function *fn, struct akl_symbol *sym)
 {
-    struct akl_state *s = ctx->cx_state;
-    struct akl_list *ir = ctx->cx_ir;
-    struct akl_ir_instruction *instr = NULL;
-
-    /* This is the very first instruction. We have to add the this to the IR
-     * and then a NOP also. The next call will modify this operation, so
-     * we will always know the address of the next operation for reference. */
-    if (akl_list_is_empty(ir)) {
-        instr = new_instr(ctx);
-        /* Add the new instruction as the first one. */
-        akl_list_append(s, ir, instr);
+    struct akl_lisp_fun *ou;
+    for (fn = fn->fn_body.ufun.uf_outer; fn != NULL; fn = ou->uf_outer) {
+        ou = &fn->fn_body.ufun;
+        if (akl_local_finder(ou, sym) != -1 || argument_finder(ou, sym) != -1)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* Index of the variable in the captures of the lambda. The variables
+   of the enclosing functions are captured at the first use. */
+static int
+capture_finder(struct akl_function *fn, struct akl_symbol *sym)
+{
+    struct akl_lisp_fun *uf = &fn->fn_body.ufun;
+    struct akl_capture *cp, c;
+    struct akl_lisp_fun *ou;
+    unsigned int i;
+    int ind;
+
+    AKL_VECTOR_FOREACH(i, cp, &uf->uf_captures) {
+        if (cp->cp_name == sym)
+            return i;
+    }
+    if (uf->uf_outer == NULL)
+        return -1;
+
+    ou = &uf->uf_outer->fn_body.ufun;
+    if ((ind = akl_local_finder(ou, sym)) != -1) {
+        c.cp_op = AKL_IR_LOCAL_GET;
+    } else if ((ind = argument_finder(ou, sym)) != -1) {
+        c.cp_op = AKL_IR_LOAD;
+    } else if ((ind = capture_finder(uf->uf_outer, sym)) != -1) {
+        c.cp_op = AKL_IR_CAPTURE_LOAD;
     } else {
-        /* If we already had a NOP, then just modify that accordingly.
-         * This always has to be the last one.
-        */
-        instr = (struct akl_ir_instruction *)akl_list_last(ir);
+        return -1;
     }
-    return instr;
+    c.cp_name = sym;
+    c.cp_ind  = ind;
+    return akl_vector_push(&uf->uf_captures, &c);
+}
+
+/* Bring a new local variable into the scope of the currently compiled
+   function. The slot is given back, when the scope ends (the locals
+   vector is truncated). */
+unsigned int
+akl_new_local(struct akl_context *ctx, struct akl_symbol *sym)
+{
+    struct akl_lisp_fun *uf = &ctx->cx_comp_func->fn_body.ufun;
+    unsigned int slot = akl_vector_push(&uf->uf_locals, &sym);
+    if (slot + 1 > uf->uf_nlocals)
+        uf->uf_nlocals = slot + 1;
+    return slot;
 }
 
+/* Reserve the next slot of the instruction array. The returned pointer is
+ * only valid until the next instruction is created, since the array
+ * can be reallocated. */
 static struct akl_ir_instruction *
 create_instr(struct akl_context *ctx)
 {
-    struct akl_ir_instruction *instr, *nop;
-    instr = create_or_get_instr(ctx);
-    /* The new NOP will be always the last in the list. The next new_instr()
-     * call will have to use that as the new operation. */
-    nop = new_instr(ctx);
-    akl_list_append(ctx->cx_state, ctx->cx_ir, nop);
+    struct akl_ir_instruction *instr;
+    AKL_ASSERT(ctx && ctx->cx_ir, NULL);
+    /* The instruction can refer to young objects */
+    if (ctx->cx_comp_func != NULL)
+        AKL_GC_WRITE_BARRIER(ctx->cx_state, ctx->cx_comp_func);
+    instr = (struct akl_ir_instruction *)akl_vector_reserve(ctx->cx_ir);
+    memset(instr, 0, sizeof(struct akl_ir_instruction));
+    instr->in_op = AKL_IR_NOP;
     return instr;
 }
 
+/* Follow the chain of unconditional jumps from the given label */
+static struct akl_label *
+thread_jump(struct akl_ir_instruction *code, unsigned int count, struct akl_label *l)
+{
+    unsigned int hops = 0;
+    while (l->la_branch < count && code[l->la_branch].in_op == AKL_IR_JMP
+           && hops++ < count) {
+        l = code[l->la_branch].in_arg[0].label;
+    }
+    return l;
+}
+
+static bool_t
+is_jump(struct akl_ir_instruction *in)
+{
+    return in->in_op == AKL_IR_JMP || in->in_op == AKL_IR_JT
+        || in->in_op == AKL_IR_JN  || in->in_op == AKL_IR_BRANCH
+        || in->in_op == AKL_IR_LIST_NEXT;
+}
+
+/* Flag the instructions in targets[], which can be reached by a jump */
+static void
+mark_jump_targets(struct akl_ir_instruction *code, unsigned int count
+                  , unsigned int *targets)
+{
+    struct akl_switch_entry *e;
+    struct akl_switch *sw;
+    unsigned int i, j;
+    memset(targets, 0, (count + 1) * sizeof(unsigned int));
+    for (i = 0; i < count; i++) {
+        if (code[i].in_op == AKL_IR_SWITCH) {
+            sw = code[i].in_arg[0].swtch;
+            AKL_VECTOR_FOREACH(j, e, &sw->sw_keys) {
+                if (e->se_label->la_branch <= count)
+                    targets[e->se_label->la_branch] = TRUE;
+            }
+            if (sw->sw_default->la_branch <= count)
+                targets[sw->sw_default->la_branch] = TRUE;
+            continue;
+        }
+        if (!is_jump(&code[i]))
+            continue;
+        if (code[i].in_arg[0].label->la_branch <= count)
+            targets[code[i].in_arg[0].label->la_branch] = TRUE;
+        if (code[i].in_op == AKL_IR_BRANCH
+            && code[i].in_arg[1].label->la_branch <= count)
+            targets[code[i].in_arg[1].label->la_branch] = TRUE;
+    }
+}
+
+/* Peephole optimizer for the complete code of a function:
+ * - Fuses two loads into a LOAD2 superinstruction
+ * - Folds the conditional jumps on a constant (push; jn/jt)
+ * - Threads the jumps, which land on an unconditional jump
+ * - Replaces the jumps to a return with the return itself
+ * - Removes the unreachable code after the unconditional jumps
+ * - Removes the NOPs and the jumps to the next instruction
+ * - Drops the unused labels, re-indexes the others
+ * The targets of a SWITCH are not threaded. */
+void akl_ir_optimize(struct akl_state *s, struct akl_lisp_fun *uf)
+{
+    struct akl_vector *ir = &uf->uf_body;
+    struct akl_ir_instruction *code, *in;
+    struct akl_list_entry *ent, *next;
+    struct akl_switch_entry *e;
+    struct akl_label *l;
+    unsigned int count = akl_vector_count(ir);
+    unsigned int *pos, i, j, n;
+    bool_t taken;
+
+    if (count == 0)
+        return;
+    code = (struct akl_ir_instruction *)akl_vector_first(ir);
+    pos = (unsigned int *)akl_calloc(s, count + 1, sizeof(unsigned int));
+
+    /* A jump target cannot be fused with the previous instruction */
+    mark_jump_targets(code, count, pos);
+
+    for (i = 0; i+1 < count; i++) {
+        in = &code[i];
+        if (pos[i+1])
+            continue;
+
+        if (in->in_op == AKL_IR_LOAD && in[1].in_op == AKL_IR_LOAD) {
+            in->in_op = AKL_IR_LOAD2;
+            in->in_arg[1].ui_num = in[1].in_arg[0].ui_num;
+            in[1].in_op = AKL_IR_NOP;
+            i++;
+        } else if (in->in_op == AKL_IR_PUSH
+                   && (in[1].in_op == AKL_IR_JN || in[1].in_op == AKL_IR_JT)) {
+            /* The condition is constant, it always or never jumps */
+            taken = AKL_IS_NIL(in->in_arg[0].value) == (in[1].in_op == AKL_IR_JN);
+            in->in_op = AKL_IR_NOP;
+            in[1].in_op = taken ? AKL_IR_JMP : AKL_IR_NOP;
+            i++;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        in = &code[i];
+        if (is_jump(in)) {
+            in->in_arg[0].label = thread_jump(code, count, in->in_arg[0].label);
+            if (in->in_op == AKL_IR_BRANCH)
+                in->in_arg[1].label = thread_jump(code, count, in->in_arg[1].label);
+        }
+        if (in->in_op == AKL_IR_JMP && in->in_arg[0].label->la_branch < count
+            && code[in->in_arg[0].label->la_branch].in_op == AKL_IR_RET)
+            in->in_op = AKL_IR_RET;
+    }
+
+    /* Nothing jumps to the code after an unconditional jump (or
+       a return), until the next jump target */
+    mark_jump_targets(code, count, pos);
+    for (i = 0; i < count; i++) {
+        if (code[i].in_op != AKL_IR_JMP && code[i].in_op != AKL_IR_RET)
+            continue;
+        for (n = i+1; n < count && !pos[n]; n++)
+            code[n].in_op = AKL_IR_NOP;
+        i = n - 1;
+    }
+
+    /* Jumps over NOPs only */
+    for (i = 0; i < count; i++) {
+        in = &code[i];
+        if (in->in_op != AKL_IR_JMP || in->in_arg[0].label->la_branch <= i)
+            continue;
+        for (n = i+1; n < in->in_arg[0].label->la_branch; n++) {
+            if (code[n].in_op != AKL_IR_NOP)
+                break;
+        }
+        if (n == in->in_arg[0].label->la_branch)
+            in->in_op = AKL_IR_NOP;
+    }
+
+    /* Remove the NOPs, pos[] holds the new offsets */
+    for (i = 0, n = 0; i < count; i++) {
+        pos[i] = n;
+        if (code[i].in_op != AKL_IR_NOP) {
+            if (n != i)
+                code[n] = code[i];
+            n++;
+        }
+    }
+    pos[count] = n;
+    ir->av_count = n;
+
+    /* Mark the used labels */
+    AKL_LIST_FOREACH(ent, &uf->uf_labels) {
+        ((struct akl_label *)ent->le_data)->la_ind = UINT_MAX;
+    }
+    for (i = 0; i < n; i++) {
+        in = &code[i];
+        if (is_jump(in)) {
+            in->in_arg[0].label->la_ind = 0;
+            if (in->in_op == AKL_IR_BRANCH)
+                in->in_arg[1].label->la_ind = 0;
+        } else if (in->in_op == AKL_IR_SWITCH) {
+            AKL_VECTOR_FOREACH(j, e, &in->in_arg[0].swtch->sw_keys) {
+                e->se_label->la_ind = 0;
+            }
+            in->in_arg[0].swtch->sw_default->la_ind = 0;
+        }
+    }
+
+    i = 0;
+    for (ent = uf->uf_labels.li_head; ent != NULL; ent = next) {
+        next = AKL_LIST_NEXT(ent);
+        l = (struct akl_label *)ent->le_data;
+        if (l->la_ind == UINT_MAX) {
+            akl_list_remove_entry(&uf->uf_labels, ent);
+            AKL_FREE(s, l);
+        } else {
+            l->la_ind = i++;
+            l->la_branch = (l->la_branch <= count) ? pos[l->la_branch] : n;
+        }
+    }
+    akl_free(s, pos, (count + 1) * sizeof(unsigned int));
+}
+
+/* Must be called, when the code of the currently compiled
+ * function (ctx->cx_ir) is complete. */
+void akl_ir_finalize(struct akl_context *ctx)
+{
+    AKL_ASSERT(ctx && ctx->cx_ir, AKL_NOTHING);
+    struct akl_function *fn = ctx->cx_comp_func;
+    if (AKL_IS_FEATURE_ON(ctx->cx_state, AKL_CFG_OPTIMIZE)
+        && fn != NULL && ctx->cx_ir == &fn->fn_body.ufun.uf_body) {
+        akl_ir_optimize(ctx->cx_state, &fn->fn_body.ufun);
+    }
+    akl_ir_resolve(ctx->cx_ir);
+}
+
 void akl_build_push(struct akl_context *ctx, struct akl_value *arg)
 {
     struct akl_ir_instruction *push = create_instr(ctx);
@@ -107,6 +347,7 @@ void akl_build_set(struct akl_context *ctx, struct akl_symbol *sym)
     struct akl_ir_instruction *set = create_instr(ctx);
     set->in_op            = AKL_IR_SET;
     set->in_arg[0].symbol = sym;
+    set->in_arg[1].var    = akl_get_var_slot(ctx->cx_state, sym);
 }
 
 void akl_build_get(struct akl_context *ctx, struct akl_symbol *sym)
@@ -114,6 +355,7 @@ void akl_build_get(struct akl_context *ctx, struct akl_symbol *sym)
     struct akl_ir_instruction *get = create_instr(ctx);
     get->in_op            = AKL_IR_GET;
     get->in_arg[0].symbol = sym;
+    get->in_arg[1].var    = akl_get_var_slot(ctx->cx_state, sym);
 }
 
 void akl_build_load(struct akl_context *ctx, struct akl_symbol *sym)
@@ -121,17 +363,30 @@ void akl_build_load(struct akl_context *ctx, struct akl_symbol *sym)
     struct akl_ir_instruction *load;
     struct akl_function *fn   = ctx->cx_comp_func;
     struct akl_lisp_fun *ufun = NULL;
+    struct akl_variable *var;
     unsigned int         ind;
 
     /* Load instructions can work on function parameters and local variables
        , but they must be  */
     if (fn->fn_type == AKL_FUNC_USER || fn->fn_type == AKL_FUNC_LAMBDA) {
         ufun = &fn->fn_body.ufun;
+        /* Locals shadow the arguments */
+        if ((ind = akl_local_finder(ufun, sym)) != -1) {
+            akl_build_local_get(ctx, ind);
         /* Get the frame offset for the currently compiled function's argument. */
-        if ((ind = argument_finder(ufun, sym)) != -1) {
+        } else if ((ind = argument_finder(ufun, sym)) != -1) {
             load                   = create_instr(ctx);
             load->in_op            = AKL_IR_LOAD;
             load->in_arg[0].ui_num = ind;
+        } else if ((ind = capture_finder(fn, sym)) != -1) {
+            /* A variable of an enclosing function */
+            load                   = create_instr(ctx);
+            load->in_op            = AKL_IR_CAPTURE_LOAD;
+            load->in_arg[0].ui_num = ind;
+        } else if ((var = akl_get_global_var(ctx->cx_state, sym)) != NULL
+                   && var->vr_is_const) {
+            /* Bound by set-const!, the value can be used directly */
+            akl_build_push(ctx, var->vr_value);
         } else {
             /* Not a parameter or local variable, must be a global one. */
             akl_build_get(ctx, sym);
@@ -139,26 +394,156 @@ void akl_build_load(struct akl_context *ctx, struct akl_symbol *sym)
     }
 }
 
+void akl_build_local_get(struct akl_context *ctx, unsigned int slot)
+{
+    struct akl_ir_instruction *get = create_instr(ctx);
+    get->in_op            = AKL_IR_LOCAL_GET;
+    get->in_arg[0].ui_num = slot;
+}
+
+/* Pops the value into the slot. With 'keep', the value stays
+   on the stack (like set) */
+void akl_build_local_set(struct akl_context *ctx, unsigned int slot, bool_t keep)
+{
+    struct akl_ir_instruction *set = create_instr(ctx);
+    set->in_op            = AKL_IR_LOCAL_SET;
+    set->in_arg[0].ui_num = slot;
+    set->in_arg[1].ui_num = keep;
+}
+
+void akl_build_function(struct akl_context *ctx, struct akl_function *fn)
+{
+    struct akl_ir_instruction *in;
+    struct akl_capture *cp;
+    unsigned int i;
+
+    if ((fn->fn_type != AKL_FUNC_USER && fn->fn_type != AKL_FUNC_LAMBDA)
+        || akl_vector_is_empty(&fn->fn_body.ufun.uf_captures)) {
+        akl_build_push(ctx, akl_new_function_value(ctx->cx_state, fn));
+        return;
+    }
+    /* Push the captured values, the closure is made from them */
+    AKL_VECTOR_FOREACH(i, cp, &fn->fn_body.ufun.uf_captures) {
+        in                   = create_instr(ctx);
+        in->in_op            = cp->cp_op;
+        in->in_arg[0].ui_num = cp->cp_ind;
+    }
+    in                   = create_instr(ctx);
+    in->in_op            = AKL_IR_CLOSURE;
+    in->in_fun           = fn;
+    in->in_arg[0].ui_num = akl_vector_count(&fn->fn_body.ufun.uf_captures);
+}
+
+unsigned int akl_build_switch(struct akl_context *ctx)
+{
+    struct akl_ir_instruction *sw = create_instr(ctx);
+    sw->in_op = AKL_IR_SWITCH;
+    return akl_vector_count(ctx->cx_ir) - 1;
+}
+
+void akl_finish_switch(struct akl_context *ctx, unsigned int at
+                       , struct akl_vector *keys, struct akl_label *def)
+{
+    struct akl_state *s = ctx->cx_state;
+    struct akl_switch *sw = AKL_MALLOC(s, struct akl_switch);
+    struct akl_switch_entry *e;
+    struct akl_ir_instruction *in;
+    unsigned int i, h, nnum = 0, nhash = 0;
+    long min = 0, max = 0;
+
+    memset(sw, 0, sizeof(struct akl_switch));
+    sw->sw_keys = *keys;
+    sw->sw_default = def;
+
+    AKL_VECTOR_FOREACH(i, e, keys) {
+        if (e->se_sym != NULL)
+            continue;
+        if (nnum == 0 || e->se_num < min)
+            min = e->se_num;
+        if (nnum == 0 || e->se_num > max)
+            max = e->se_num;
+        nnum++;
+    }
+    /* Dense enough for an index table */
+    if (nnum > 0 && (unsigned long)(max - min) < 2*nnum + 8) {
+        sw->sw_min   = min;
+        sw->sw_range = max - min + 1;
+        sw->sw_table = (struct akl_label **)akl_calloc(s, sw->sw_range
+                                                   , sizeof(struct akl_label *));
+        AKL_VECTOR_FOREACH(i, e, keys) {
+            /* On duplicated keys, the first one wins */
+            if (e->se_sym == NULL && sw->sw_table[e->se_num - min] == NULL)
+                sw->sw_table[e->se_num - min] = e->se_label;
+        }
+        nhash = akl_vector_count(keys) - nnum;
+    } else {
+        nhash = akl_vector_count(keys);
+    }
+
+    if (nhash > 0) {
+        for (sw->sw_hash_size = 4; sw->sw_hash_size < 2*nhash; sw->sw_hash_size *= 2)
+            ;
+        sw->sw_hash = (struct akl_switch_entry *)akl_calloc(s, sw->sw_hash_size
+                                                   , sizeof(struct akl_switch_entry));
+        AKL_VECTOR_FOREACH(i, e, keys) {
+            if (e->se_sym == NULL && sw->sw_table != NULL)
+                continue;
+            h = akl_switch_hash(e->se_sym, e->se_num) & (sw->sw_hash_size - 1);
+            while (sw->sw_hash[h].se_label != NULL
+                   && (sw->sw_hash[h].se_sym != e->se_sym
+                       || sw->sw_hash[h].se_num != e->se_num))
+                h = (h + 1) & (sw->sw_hash_size - 1);
+            if (sw->sw_hash[h].se_label == NULL)
+                sw->sw_hash[h] = *e;
+        }
+    }
+
+    in = (struct akl_ir_instruction *)akl_vector_at(ctx->cx_ir, at);
+    in->in_arg[0].swtch = sw;
+}
+
 void akl_build_call(struct akl_context *ctx, struct akl_symbol *sym
                     , struct akl_function *fn, int argc)
 {
     struct akl_ir_instruction *call = create_instr(ctx);
+    akl_ir_instruction_t op = AKL_IR_NOP;
     call->in_op = AKL_IR_CALL;
     call->in_arg[0].symbol = sym;
-    /* If function already fetched, this will make things faster. */
-    call->in_fun           = fn;
+    /* Named functions are looked up (and cached) at the first call,
+       since the symbol can be rebound after the compilation. */
+    call->in_fun           = (sym == NULL) ? fn : NULL;
     call->in_arg[1].ui_num = argc;
+
+    if (sym != NULL)
+        op = akl_builtin_instruction(fn, argc);
+    /* The builtin has its own instruction. The cache holds the
+       builtin, the instruction is valid until its variable changes. */
+    if (op != AKL_IR_NOP) {
+        call->in_op   = op;
+        call->in_cvar = akl_get_global_var(ctx->cx_state, sym);
+        call->in_cver = call->in_cvar->vr_version;
+        call->in_fun  = fn;
+    }
+}
+
+/* The called function replaces the current one, if it is a lisp function */
+void akl_build_tailcall(struct akl_context *ctx, struct akl_symbol *sym
+                        , struct akl_function *fn, int argc)
+{
+    struct akl_ir_instruction *call;
+    akl_build_call(ctx, sym, fn, argc);
+    call = (struct akl_ir_instruction *)akl_vector_at(ctx->cx_ir
+                                    , akl_vector_count(ctx->cx_ir)-1);
+    if (call->in_op == AKL_IR_CALL)
+        call->in_op = AKL_IR_TAILCALL;
 }
 
 void akl_build_label(struct akl_context *ctx, struct akl_list *labels, int lc)
 {
     struct akl_label *l = (struct akl_label *)akl_list_index(labels, lc);
-    l->la_ir = ctx->cx_ir;
-    /* Always point to the last instruction.
-     * If that doesn't exist, create a NOP as placeholder.
-    */
-    create_or_get_instr(ctx);
-    l->la_branch = AKL_LIST_LAST(ctx->cx_ir);
+    /* Always point to the next instruction (that will be
+       the end of the IR, if nothing is built after the label) */
+    l->la_branch = akl_vector_count(ctx->cx_ir);
 }
 
 /* It can also mean 'jmp' if the second (the false branch is NULL) */
@@ -183,12 +568,95 @@ void akl_build_ret(struct akl_context *ctx)
     ret->in_op = AKL_IR_RET;
 }
 
+void akl_build_pop(struct akl_context *ctx)
+{
+    struct akl_ir_instruction *pop = create_instr(ctx);
+    pop->in_op = AKL_IR_POP;
+}
+
+void akl_build_list_iter(struct akl_context *ctx)
+{
+    struct akl_ir_instruction *iter = create_instr(ctx);
+    iter->in_op = AKL_IR_LIST_ITER;
+}
+
+void akl_build_number_check(struct akl_context *ctx)
+{
+    struct akl_ir_instruction *check = create_instr(ctx);
+    check->in_op = AKL_IR_NUMBER_CHECK;
+}
+
+void akl_build_list_next(struct akl_context *ctx, unsigned int slot
+                         , struct akl_list *l, int lc)
+{
+    struct akl_ir_instruction *next = create_instr(ctx);
+    next->in_op            = AKL_IR_LIST_NEXT;
+    next->in_arg[0].label  = (struct akl_label *)akl_list_index(l, lc);
+    next->in_arg[1].ui_num = slot;
+}
+
 void akl_build_nop(struct akl_context *ctx)
 {
     struct akl_ir_instruction *nop = create_instr(ctx);
     nop->in_op = AKL_IR_NOP;
 }
 
+/* Call a pure builtin at compile time, if all of its arguments are
+   constants (the last argc instructions are pushes, from 'first').
+   The pushes are replaced with the result. */
+static bool_t
+fold_constant_call(struct akl_context *cx, struct akl_symbol *sym
+                   , struct akl_function *fn, unsigned int first, int argc)
+{
+    struct akl_state *s = cx->cx_state;
+    struct akl_ir_instruction *code;
+    struct akl_context *fcx;
+    struct akl_list *errors;
+    struct akl_value *v;
+    unsigned int sp, i;
+
+    if (!AKL_IS_FEATURE_ON(s, AKL_CFG_OPTIMIZE) || fn == NULL
+        || fn->fn_type != AKL_FUNC_CFUN || !fn->fn_is_pure
+        || akl_vector_count(cx->cx_ir) != first + argc)
+        return FALSE;
+
+    code = (struct akl_ir_instruction *)akl_vector_first(cx->cx_ir);
+    for (i = first; i < first + argc; i++) {
+        if (code[i].in_op != AKL_IR_PUSH)
+            return FALSE;
+    }
+
+    fcx = akl_bound_function(cx, sym, fn);
+    if (fcx == NULL)
+        return FALSE;
+    /* Use the (otherwise empty) stack of the state */
+    fcx->cx_stack = &s->ai_stack;
+    sp = akl_vector_count(fcx->cx_stack);
+    for (i = first; i < first + argc; i++)
+        akl_stack_push(fcx, code[i].in_arg[0].value);
+
+    /* On error, leave it for the run time */
+    errors = s->ai_errors;
+    s->ai_errors = NULL;
+    v = akl_call_function_bound(fcx, argc);
+    fcx->cx_stack->av_count = sp;
+    akl_release_context(fcx);
+    if (s->ai_errors != NULL) {
+        /* The error records of the call are not needed */
+        akl_clear_errors(s);
+        v = NULL;
+    }
+    s->ai_errors = errors;
+    if (v == NULL)
+        return FALSE;
+
+    if (!AKL_IS_IMMEDIATE(v))
+        AKL_GC_SET_STATIC(v);
+    cx->cx_ir->av_count = first;
+    akl_build_push(cx, v);
+    return TRUE;
+}
+
 enum PREFETCH_STATUS {
    PF_FN_NOT_FOUND, PF_FN_NORMAL, PF_FN_SFORM, PF_NOT_FN
 };
@@ -238,8 +706,11 @@ akl_compile_list(struct akl_context *cx)
     struct akl_value *v;
     enum PREFETCH_STATUS pf_st = PF_FN_NOT_FOUND;
     int    argc              = 0;
+    unsigned int first       = 0; /* Offset of the first argument's code */
     bool_t felem             = TRUE;
     bool_t is_quoted         = FALSE;
+    bool_t is_tail           = FALSE;
+    bool_t is_toplevel       = FALSE;
     struct akl_function *fun = NULL, *f = NULL;
     struct akl_symbol   *sym = NULL;
     struct akl_lex_info *call_info = NULL;
@@ -250,6 +721,11 @@ akl_compile_list(struct akl_context *cx)
     assert(cx);
     s   = cx->cx_state;
     dev = cx->cx_dev;
+    /* Only the call itself can be in tail position, its arguments not */
+    is_tail = cx->cx_is_tail;
+    cx->cx_is_tail = FALSE;
+    is_toplevel = cx->cx_is_toplevel;
+    cx->cx_is_toplevel = FALSE;
 
     while ((tok = akl_lex(cx->cx_dev))) {
         if (s->ai_interrupted) {
@@ -277,11 +753,16 @@ akl_compile_list(struct akl_context *cx)
                 pf_st = prefetch_function(cx, v, &fun);
                 if (pf_st == PF_FN_SFORM) {
                     /* It's a special form, call it immediately. */
+                    cx->cx_is_tail = is_tail;
+                    cx->cx_is_toplevel = is_toplevel;
                     fun = akl_call_sform(cx, v->va_value.symbol, fun);
+                    cx->cx_is_tail = FALSE;
+                    cx->cx_is_toplevel = FALSE;
                 } else if (pf_st == PF_FN_NORMAL || pf_st == PF_FN_NOT_FOUND) {
                     /* No global functions with this name, try to resolve it later. */
                     sym = v->va_value.symbol;
                 }
+                first = akl_vector_count(cx->cx_ir);
             } else {
                 if (is_quoted) {
                     akl_build_push(cx, v);
@@ -305,7 +786,7 @@ akl_compile_list(struct akl_context *cx)
                     if (felem) {
                         fun = f;
                     } else {
-                        akl_build_push(cx, akl_new_function_value(cx->cx_state, f));
+                        akl_build_function(cx, f);
                     }
                 }
             }
@@ -325,8 +806,13 @@ akl_compile_list(struct akl_context *cx)
                 }
             } else {
                 /* We are run out of arguments, it's time for a function call */
+                if (fold_constant_call(cx, sym, fun, first, argc))
+                    ;
+                else if (is_tail)
+                    akl_build_tailcall(cx, sym, fun, argc);
+                else
+                    akl_build_call(cx, sym, fun, argc);
                 akl_ir_set_lex_info(cx, call_info);
-                akl_build_call(cx, sym, fun, argc);
             }
         return NULL;
 
@@ -365,6 +851,8 @@ akl_compile_next(struct akl_context *ctx, struct akl_function **fn)
         akl_build_push(ctx, akl_parse_token(ctx, tok, TRUE));
     } else if (tok == tEOF) {
         return tok;
+    } else if (tok == tATOM) {
+        akl_build_load(ctx, akl_lex_get_symbol(ctx->cx_dev));
     } else {
         akl_build_push(ctx, akl_parse_token(ctx, tok, FALSE));
     }
@@ -376,10 +864,9 @@ struct akl_context *akl_compile(struct akl_state *s, struct akl_io_device *dev)
     AKL_ASSERT(s && dev, NULL);
     struct akl_context *cx = akl_new_context(s);
     struct akl_function *f = akl_new_function(s);
-    struct akl_ir_instruction *lip;
     akl_token_t tok;
 
-    akl_init_list(&f->fn_body.ufun.uf_body);
+    akl_init_lisp_fun(s, &f->fn_body.ufun);
     f->fn_type = AKL_FUNC_USER;
     cx->cx_fn_main = f;
 
@@ -388,18 +875,114 @@ struct akl_context *akl_compile(struct akl_state *s, struct akl_io_device *dev)
     cx->cx_ir = &f->fn_body.ufun.uf_body;
 
     do {
+        cx->cx_is_toplevel = TRUE;
         tok = akl_compile_next(cx, NULL);
     } while (tok != tEOF);
-    /* Don't need the last NOP anymore, remove it. */
-    lip = akl_list_pop(cx->cx_ir);
-    if (lip && lip->in_op != AKL_IR_NOP) {
-       /* Something is wrong if it got here. Undo everything
-          and just pretend it will be ok again.˙*/
-        akl_list_append(s, cx->cx_ir, lip);
-    }
+    cx->cx_is_toplevel = FALSE;
+    akl_ir_finalize(cx);
     return cx;
 }
 
+/* With lazy-compile, only the place of the function body is
+   recorded and the body is skipped. Gives TRUE, if the body
+   is deferred (only bodies from files can be read again). */
+bool_t
+akl_compile_defer(struct akl_context *ctx, struct akl_function *fn)
+{
+    struct akl_state *s = ctx->cx_state;
+    struct akl_io_device *dev = ctx->cx_dev;
+    struct akl_lazy_body *lb;
+    akl_token_t tok;
+    long offset;
+
+    if (!AKL_IS_FEATURE_ON(s, AKL_CFG_LAZY_COMPILE) || dev == NULL
+        || dev->iod_type != DEVICE_FILE || dev->iod_name == NULL)
+        return FALSE;
+
+    /* The lexer is just after the left brace of the body */
+    tok = akl_lex(dev);
+    if (tok != tLBRACE
+        || (offset = ftell(dev->iod_source.file)) <= 0) {
+        akl_lex_putback(dev, tok);
+        return FALSE;
+    }
+
+    lb = AKL_MALLOC(s, struct akl_lazy_body);
+    /* The name of a loaded file can be gone at the first call,
+       the lexical informations of the body will use this copy */
+    lb->lb_file   = AKL_STRDUP(dev->iod_name);
+    lb->lb_offset = offset - 1;
+    lb->lb_line   = dev->iod_line_count;
+    lb->lb_column = dev->iod_char_count - 1;
+    if (ctx->cx_lex_info != NULL) {
+        lb->lb_defun_line   = ctx->cx_lex_info->li_line;
+        lb->lb_defun_column = ctx->cx_lex_info->li_count;
+    } else {
+        lb->lb_defun_line   = lb->lb_line;
+        lb->lb_defun_column = 0;
+    }
+    fn->fn_body.ufun.uf_lazy = lb;
+
+    if (!akl_lex_skip_list(dev))
+        akl_raise_error(ctx, AKL_ERROR, "Unexpected end of file in a function body");
+    return TRUE;
+}
+
+/* Compile the deferred body of the function (at its first call) */
+void
+akl_compile_lazy(struct akl_context *ctx, struct akl_function *fn)
+{
+    struct akl_state *s = ctx->cx_state;
+    struct akl_lisp_fun *uf = &fn->fn_body.ufun;
+    struct akl_lazy_body *lb = uf->uf_lazy;
+    struct akl_lex_info *info;
+    struct akl_context cx;
+    struct akl_function *f;
+    FILE *fp;
+
+    uf->uf_lazy = NULL;
+    akl_init_context(&cx);
+    cx.cx_state     = s;
+    cx.cx_comp_func = fn;
+    cx.cx_ir        = &uf->uf_body;
+    /* The errors of the whole body are reported at the defun! form
+       (not at the first call) */
+    info = AKL_MALLOC(s, struct akl_lex_info);
+    info->li_name  = lb->lb_file;
+    info->li_line  = lb->lb_defun_line;
+    info->li_count = lb->lb_defun_column;
+    cx.cx_lex_info = info;
+
+    fp = fopen(lb->lb_file, "r");
+    if (fp == NULL || fseek(fp, lb->lb_offset, SEEK_SET) != 0) {
+        akl_raise_error(&cx, AKL_ERROR, "Cannot compile the function, "
+                        "cannot read file '%s'", lb->lb_file);
+    } else {
+        cx.cx_dev = akl_new_file_device(s, lb->lb_file, fp);
+        cx.cx_dev->iod_line_count = lb->lb_line;
+        cx.cx_dev->iod_char_count = lb->lb_column;
+        /* Same as the body in defun! */
+        cx.cx_is_tail = TRUE;
+        akl_compile_next(&cx, &f);
+        cx.cx_is_tail = FALSE;
+        if (f)
+            akl_build_function(&cx, f);
+        /* The file was changed since the defun! */
+        if (feof(fp)) {
+            cx.cx_lex_info = info;
+            akl_raise_error(&cx, AKL_ERROR
+                            , "Unexpected end of file in a function body");
+        }
+        akl_lex_free(cx.cx_dev);
+        AKL_FREE(s, cx.cx_dev);
+    }
+    if (fp != NULL)
+        fclose(fp);
+    akl_build_ret(&cx);
+    akl_ir_finalize(&cx);
+    AKL_FREE(s, lb);
+}
+
 void akl_asm_parse_func(struct akl_context *);
 
 struct akl_context *
@@ -407,7 +990,7 @@ akl_asm_compile(struct akl_state *s, struct akl_io_device *dev)
 {
     akl_asm_token_t tok;
     struct akl_context *cx = akl_new_context(s);
-    cx->cx_ir = akl_new_list(s);
+    cx->cx_ir = akl_new_vector(s, 0, sizeof(struct akl_ir_instruction));
     cx->cx_dev = dev;
 
     while ((tok = akl_asm_lex(dev)) != tEOF) {
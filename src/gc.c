@@ -22,17 +22,44 @@
  ************************************************************************/
 #include <stdlib.h>
 #include <limits.h>
+#include <time.h>
 #include "aklisp.h"
 
 #define BITS_IN_UINT (sizeof(unsigned int)*8)
 #define BIT_INDEX(ptr, ind) ((ptr)[(ind)/BITS_IN_UINT])
 
-#define SET_BIT(V, N) ((V) |= (1 << (N)))
-#define CLEAR_BIT(V, N) ((V) &= ~(1 << (N)))
-#define TEST_BIT(V, N) ((V) & (1 << (N)))
+#define BIT_MASK(N) (1U << ((N) % BITS_IN_UINT))
+#define SET_BIT(V, N) ((V) |= BIT_MASK(N))
+#define CLEAR_BIT(V, N) ((V) &= ~BIT_MASK(N))
+#define TEST_BIT(V, N) ((V) & BIT_MASK(N))
 #define IS_BIT_SET(V, N) TEST_BIT(V, N)
 #define IS_BIT_NOT_SET(V, N) (!TEST_BIT(V, N))
 
+/* The lowest set bit and the count of the set bits of a word
+   (V cannot be zero for FIRST_BIT) */
+#if defined(__GNUC__)
+# define FIRST_BIT(V) __builtin_ctz(V)
+# define COUNT_BITS(V) __builtin_popcount(V)
+#else
+static inline int FIRST_BIT(unsigned int v)
+{
+    int n = 0;
+    while (!(v & 1)) {
+        v >>= 1;
+        n++;
+    }
+    return n;
+}
+
+static inline int COUNT_BITS(unsigned int v)
+{
+    int n = 0;
+    for (; v != 0; v &= v - 1)
+        n++;
+    return n;
+}
+#endif
+
 struct akl_mem_callbacks akl_mem_std_callbacks = {
     .mc_malloc_fn  = malloc,
     .mc_calloc_fn  = calloc,
@@ -137,14 +164,65 @@ void akl_set_mem_callbacks(struct akl_state *s, const struct akl_mem_callbacks *
      s->ai_mem_fn = cbs;
 }
 
-akl_gc_type_t akl_gc_register_type(struct akl_state *s, akl_gc_marker_t marker, size_t objsize)
+/* A pool has at least this many slots (if it fits to the biggest pool) */
+#define AKL_GC_POOL_MIN_SLOTS 8
+#define AKL_GC_OBJ_ALIGN 16
+#define POOL_WORDS(n) (((n) + BITS_IN_UINT - 1)/BITS_IN_UINT)
+
+/* Offset of the first slot: after the header and the bitmap */
+static size_t akl_gc_pool_offset(unsigned int slots)
+{
+    size_t off = sizeof(struct akl_gc_pool) + POOL_WORDS(slots)*sizeof(unsigned int);
+    return (off + AKL_GC_OBJ_ALIGN - 1) & ~(size_t)(AKL_GC_OBJ_ALIGN - 1);
+}
+
+static unsigned int akl_gc_pool_slots(size_t bytes, size_t objsize)
+{
+    unsigned int n = (bytes - sizeof(struct akl_gc_pool))/objsize;
+    while (n > 0 && akl_gc_pool_offset(n) + n*objsize > bytes)
+        n--;
+    return n;
+}
+
+/* The size classes of the pools are the powers of 2 */
+static size_t akl_gc_pool_class(size_t bytes, size_t objsize)
+{
+    size_t c = AKL_GC_POOL_MIN_BYTES;
+    while (c < AKL_GC_POOL_MAX_BYTES
+           && (c < bytes || akl_gc_pool_slots(c, objsize) < AKL_GC_POOL_MIN_SLOTS))
+        c <<= 1;
+    return c;
+}
+
+/**
+ * @brief Register a new type of GC'd objects
+ * @param s An instance of the interpreter
+ * @param marker Marks (or unmarks) the object and its references
+ * @param objsize Size of an object
+ * @param poolsize Size of a pool of the type in bytes (rounded up
+ * to a power of 2), 0 for the default (AKL_GC_POOL_BYTES)
+ * @return The id of the new type
+*/
+akl_gc_type_t akl_gc_register_type(struct akl_state *s, akl_gc_marker_t marker
+                                   , size_t objsize, size_t poolsize)
 {
     assert(s);
     struct akl_gc_type *t = (struct akl_gc_type *)akl_vector_reserve(&s->ai_gc_types);
+    if (poolsize == 0)
+        poolsize = AKL_GC_POOL_BYTES;
+    t->gt_pool_bytes = akl_gc_pool_class(poolsize, objsize);
+    t->gt_pool_slots = akl_gc_pool_slots(t->gt_pool_bytes, objsize);
+    assert(t->gt_pool_slots > 0);
     t->gt_marker_fn  = marker;
+    t->gt_destructor_fn = NULL;
     t->gt_pool_count = 0;
     t->gt_pool_last  = NULL;
     t->gt_pool_head  = NULL;
+    t->gt_free       = NULL;
+    t->gt_nursery    = NULL;
+    t->gt_nursery_cur = NULL;
+    t->gt_sweep      = NULL;
+    t->gt_sweep_prev = NULL;
     t->gt_type_id    = s->ai_gc_types.av_count-1;
     t->gt_type_size  = objsize;
     return t->gt_type_id;
@@ -174,13 +252,31 @@ void akl_gc_mark_object(struct akl_state *s, void *obj, bool_t m)
     }
 }
 
-static void akl_gc_mark_value(struct akl_state *s, void *obj, bool_t m)
+/* The markers set the mark of the object to 'm' and follow its
+   references, until they find an object, which is already marked
+   (or unmarked) so the cycles are also handled. Lists can be
+   embedded in other structures (outside of the pools), so they
+   are always walked, the cycles are stopped at their values.
+   In the mark phase of the incremental collection the references
+   are not followed right away: The marked object is only put to
+   the gray stack, and a later slice scans it (see akl_gc_step()).
+   A list is put there as its next entry, so a long list is walked
+   by many slices. */
+static void akl_gc_mark_list(struct akl_state *, void *, bool_t);
+static void akl_gc_mark_function(struct akl_state *, void *, bool_t);
+static void akl_gc_mark_udata(struct akl_state *, void *, bool_t);
+
+static bool_t akl_gc_gray(struct akl_state *s, void *obj)
 {
-    assert(obj);
-    struct akl_value *v = (struct akl_value *)obj;
-    if (v == &NIL_VALUE || v == &TRUE_VALUE)
-        return;
+    if (s->ai_gc_phase != AKL_GC_PHASE_MARK)
+        return FALSE;
+    akl_vector_push(&s->ai_gc_gray, &obj);
+    return TRUE;
+}
 
+static void akl_gc_scan_value(struct akl_state *s, struct akl_value *v, bool_t m)
+{
+    s->ai_gc_work++;
     switch (v->va_type) {
         case AKL_VT_SYMBOL:
         /* Symbols are not GC'd */
@@ -192,13 +288,36 @@ static void akl_gc_mark_value(struct akl_state *s, void *obj, bool_t m)
 
         case AKL_VT_LIST:
         if (v->va_value.list)
-            AKL_GC_SET_MARK(v->va_value.list, m);
+            akl_gc_mark_list(s, v->va_value.list, m);
+        break;
+
+        case AKL_VT_FUNCTION:
+        if (v->va_value.func)
+            akl_gc_mark_function(s, v->va_value.func, m);
+        break;
+
+        case AKL_VT_USERDATA:
+        if (v->va_value.udata)
+            akl_gc_mark_udata(s, v->va_value.udata, m);
         break;
 
         default:
         break;
     }
+}
+
+static void akl_gc_mark_value(struct akl_state *s, void *obj, bool_t m)
+{
+    assert(obj);
+    struct akl_value *v = (struct akl_value *)obj;
+    /* Immediate numbers have no heap object */
+    if (v == &NIL_VALUE || v == &TRUE_VALUE || AKL_IS_IMMEDIATE(v))
+        return;
+    if (v->gc_obj.gc_mark == m)
+        return;
     AKL_GC_SET_MARK(v, m);
+    if (!akl_gc_gray(s, v))
+        akl_gc_scan_value(s, v, m);
 }
 
 static void akl_gc_mark_list_entry(struct akl_state *s, void *obj, bool_t m)
@@ -207,9 +326,10 @@ static void akl_gc_mark_list_entry(struct akl_state *s, void *obj, bool_t m)
     struct akl_value *v;
     struct akl_list_entry *le = (struct akl_list_entry *)obj;
     AKL_GC_SET_MARK(le, m);
+    s->ai_gc_work++;
     if (le->gc_obj.gc_le_is_obj) {
         v = (struct akl_value *)le->le_data;
-        if (v)
+        if (v && !AKL_IS_IMMEDIATE(v))
             akl_gc_mark_object(s, v, m);
     }
 }
@@ -218,20 +338,86 @@ static void
 akl_gc_mark_variable(struct akl_state *s, void *obj, bool_t m)
 {
     struct akl_variable *var = (struct akl_variable *)obj;
+    if (var->gc_obj.gc_mark == m)
+        return;
     AKL_GC_SET_MARK(var, m);
-    if (var->vr_value) {
+    if (!akl_gc_gray(s, var) && var->vr_value)
         akl_gc_mark_value(s, var->vr_value, m);
+}
+
+/* The constants of the code are only referenced by the instructions */
+static void
+akl_gc_mark_ir(struct akl_state *s, struct akl_vector *ir, bool_t m)
+{
+    struct akl_ir_instruction *in;
+    unsigned int i;
+    AKL_VECTOR_FOREACH(i, in, ir) {
+        if (in->in_op == AKL_IR_PUSH && in->in_arg[0].value != NULL)
+            akl_gc_mark_value(s, in->in_arg[0].value, m);
+        else if ((in->in_op == AKL_IR_GET || in->in_op == AKL_IR_SET)
+                 && in->in_arg[1].var != NULL)
+            akl_gc_mark_variable(s, in->in_arg[1].var, m);
+        /* The called function (and the lambda of a closure) */
+        if (in->in_fun != NULL)
+            akl_gc_mark_function(s, in->in_fun, m);
+        if (in->in_cvar != NULL)
+            akl_gc_mark_variable(s, in->in_cvar, m);
+        /* The jump tables of SWITCH only have symbols, numbers
+           and labels, they are not GC'd objects */
     }
 }
 
+static void
+akl_gc_scan_function(struct akl_state *s, struct akl_function *fn, bool_t m)
+{
+    struct akl_lisp_fun *uf;
+    unsigned int i, n;
+    s->ai_gc_work++;
+    if (fn->fn_type != AKL_FUNC_USER && fn->fn_type != AKL_FUNC_LAMBDA)
+        return;
+
+    uf = &fn->fn_body.ufun;
+    /* The captured values of a closure */
+    if (fn->fn_captures != NULL) {
+        n = akl_vector_count(&uf->uf_captures);
+        for (i = 0; i < n; i++) {
+            if (fn->fn_captures[i] != NULL)
+                akl_gc_mark_value(s, fn->fn_captures[i], m);
+        }
+    }
+    akl_gc_mark_ir(s, &uf->uf_body, m);
+    /* The labels are in a list of GC'd entries */
+    akl_gc_mark_list(s, &uf->uf_labels, m);
+}
+
 static void
 akl_gc_mark_function(struct akl_state *s, void *obj, bool_t m)
 {
+    struct akl_function *fn = (struct akl_function *)obj;
+    if (fn->gc_obj.gc_mark == m)
+        return;
+    AKL_GC_SET_MARK(fn, m);
+    if (!akl_gc_gray(s, fn))
+        akl_gc_scan_function(s, fn, m);
+}
+
+/* The captured values of a closure are outside of the pools */
+static void akl_gc_free_function(struct akl_state *s, void *obj)
+{
+    struct akl_function *fn = (struct akl_function *)obj;
+    if (fn->fn_captures == NULL)
+        return;
+    akl_free(s, fn->fn_captures, sizeof(struct akl_value *)
+             * akl_vector_count(&fn->fn_body.ufun.uf_captures));
+    fn->fn_captures = NULL;
 }
 
 static void
 akl_gc_mark_udata(struct akl_state *s, void *obj, bool_t m)
 {
+    struct akl_userdata *udata = (struct akl_userdata *)obj;
+    /* The private data is not known by the GC */
+    AKL_GC_SET_MARK(udata, m);
 }
 
 /* NOTE: Only call with value lists! */
@@ -239,146 +425,636 @@ static void akl_gc_mark_list(struct akl_state *s, void *obj, bool_t m)
 {
     struct akl_list *list = (struct akl_list *)obj;
     struct akl_list_entry *ent;
+    AKL_GC_SET_MARK(list, m);
+    if (list->li_head != NULL && akl_gc_gray(s, list->li_head))
+        return;
     AKL_LIST_FOREACH(ent, list) {
         if (ent)
-            akl_gc_mark_object(s, ent, m);
+            akl_gc_mark_list_entry(s, ent, m);
     }
-    AKL_GC_SET_MARK(list, m);
 }
 
-void akl_gc_mark(struct akl_state *s)
+/* Follow the references of a gray object (only the base types
+   with references and the list entries are put to the gray stack) */
+static void akl_gc_scan_gray(struct akl_state *s, void *obj)
 {
-    /* Walk around the IR and the variables */
+    struct akl_gc_generic_object *go = (struct akl_gc_generic_object *)obj;
+    struct akl_variable *var;
+    struct akl_list_entry *ent;
+    switch (AKL_GC_TYPE_ID(go)) {
+        case AKL_GC_VALUE:
+        akl_gc_scan_value(s, (struct akl_value *)obj, TRUE);
+        break;
+
+        case AKL_GC_VARIABLE:
+        var = (struct akl_variable *)obj;
+        s->ai_gc_work++;
+        if (var->vr_value)
+            akl_gc_mark_value(s, var->vr_value, TRUE);
+        break;
+
+        case AKL_GC_FUNCTION:
+        akl_gc_scan_function(s, (struct akl_function *)obj, TRUE);
+        break;
+
+        case AKL_GC_LIST_ENTRY:
+        /* The cursor of a list: The rest of the list is put back
+           (the unlinked entries keep their next pointer, so the walk
+           cannot miss the entries after them) */
+        ent = (struct akl_list_entry *)obj;
+        if (ent->le_next != NULL)
+            akl_vector_push(&s->ai_gc_gray, &ent->le_next);
+        akl_gc_mark_list_entry(s, ent, TRUE);
+        break;
+
+        default:
+        break;
+    }
 }
 
-void akl_gc_mark_all(struct akl_state *s)
+static void
+akl_gc_mark_stack(struct akl_state *s, struct akl_vector *stack)
 {
-    struct akl_atom *atom;
-    if (!AKL_IS_FEATURE_ON(s, AKL_CFG_USE_GC)) 
+    struct akl_value **vp;
+    unsigned int i;
+    if (stack == NULL || stack->av_vector == NULL)
         return;
-#if 0
-    RB_FOREACH(atom, ATOM_TREE, &s->ai_atom_head) {
-        akl_gc_mark_atom(atom, TRUE);
+    vp = (struct akl_value **)stack->av_vector;
+    for (i = 0; i < stack->av_count; i++) {
+        if (vp[i] != NULL)
+            akl_gc_mark_value(s, vp[i], TRUE);
+    }
+}
+
+/* The functions of the context and the values of its stack (the
+   arguments and the local variables of every frame are in it) */
+static void
+akl_gc_mark_context(struct akl_state *s, struct akl_context *cx
+                    , struct akl_vector **last_stack)
+{
+    if (cx->cx_func != NULL)
+        akl_gc_mark_function(s, cx->cx_func, TRUE);
+    if (cx->cx_fn_main != NULL)
+        akl_gc_mark_function(s, cx->cx_fn_main, TRUE);
+    if (cx->cx_comp_func != NULL)
+        akl_gc_mark_function(s, cx->cx_comp_func, TRUE);
+    /* The called contexts mostly share the stack of the caller */
+    if (cx->cx_stack != *last_stack) {
+        akl_gc_mark_stack(s, cx->cx_stack);
+        *last_stack = cx->cx_stack;
     }
+}
+
+/* Mark every object, which is reachable from the state */
+void akl_gc_mark(struct akl_state *s)
+{
+    struct akl_symbol *sym;
+    struct akl_vector *last = NULL;
+    unsigned int i;
+
+    /* Every global variable is the slot of its symbol, so the
+       symbol table also covers the tree of the variables */
+    for (i = 0; i < s->ai_symbols.st_size; i++) {
+        sym = s->ai_symbols.st_slots[i];
+        if (sym != NULL && sym->sb_var != NULL)
+            akl_gc_mark_variable(s, sym->sb_var, TRUE);
+    }
+
+    akl_gc_mark_list(s, &s->ai_modules, TRUE);
+    if (s->ai_errors != NULL)
+        akl_gc_mark_list(s, s->ai_errors, TRUE);
+
+    akl_gc_mark_stack(s, &s->ai_stack);
+    akl_gc_mark_context(s, &s->ai_context, &last);
+    for (i = 0; i < s->ai_call_depth; i++)
+        akl_gc_mark_context(s, &s->ai_call_stack[i], &last);
+}
+
+/*
+ * The objects are allocated in the nursery of their type, a chain
+ * of pools, where the allocation just bumps the gp_top index of the
+ * current pool. The minor collection marks the young objects from the
+ * roots and from the remembered objects, and sweeps only the nursery.
+ * The marks of the survivors are kept, a marked object is an old one,
+ * so the marking stops at the old objects. The objects are never
+ * moved (the C code holds plain pointers to them): A pool with
+ * survivors is promoted as a whole to the pool chain of its type,
+ * the others are emptied and reused by the nursery.
+ */
+
+/* Monotonic time in microseconds, for the pause statistics */
+static unsigned long akl_gc_usec(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000UL + ts.tv_nsec/1000;
+#else
+    return (unsigned long)(clock()/(CLOCKS_PER_SEC/1000000.0));
 #endif
+}
+
+static void akl_gc_sweep_pool_slots(struct akl_state *, struct akl_gc_pool *
+                                    , akl_gc_destructor_t);
+bool_t akl_gc_pool_have_free(struct akl_gc_pool *);
+static void akl_gc_sweep_old_pool(struct akl_state *, struct akl_gc_type *);
+
+/* Put an old object to the remembered set (see AKL_GC_WRITE_BARRIER()) */
+void akl_gc_remember(struct akl_state *s, void *obj)
+{
+    struct akl_gc_generic_object *go = (struct akl_gc_generic_object *)obj;
+    go->gc_obj.gc_remembered = TRUE;
+    akl_vector_push(&s->ai_gc_remembered, &obj);
+}
+
+/* The remembered objects are marked again, with all of their
+   (young) references */
+static void akl_gc_mark_remembered(struct akl_state *s)
+{
+    struct akl_gc_generic_object **rp;
+    unsigned int i;
+    rp = (struct akl_gc_generic_object **)s->ai_gc_remembered.av_vector;
+    for (i = 0; i < s->ai_gc_remembered.av_count; i++) {
+        rp[i]->gc_obj.gc_remembered = FALSE;
+        AKL_GC_SET_MARK(rp[i], FALSE);
+        akl_gc_mark_object(s, rp[i], TRUE);
+    }
+    s->ai_gc_remembered.av_count = 0;
+}
+
+static void akl_gc_forget_remembered(struct akl_state *s)
+{
+    struct akl_gc_generic_object **rp;
+    unsigned int i;
+    rp = (struct akl_gc_generic_object **)s->ai_gc_remembered.av_vector;
+    for (i = 0; i < s->ai_gc_remembered.av_count; i++)
+        rp[i]->gc_obj.gc_remembered = FALSE;
+    s->ai_gc_remembered.av_count = 0;
+}
+
+static void akl_gc_mark_roots(struct akl_context *ctx)
+{
+    struct akl_vector *last = NULL;
+    struct akl_context *cx;
+    akl_gc_mark(ctx->cx_state);
+    for (cx = ctx; cx != NULL; cx = cx->cx_parent)
+        akl_gc_mark_context(ctx->cx_state, cx, &last);
+}
+
+static void akl_gc_pool_reset(struct akl_gc_pool *p)
+{
+    unsigned int words = POOL_WORDS(p->gp_size);
+    p->gp_count = 0;
+    p->gp_top = 0;
+    p->gp_old = 0;
+    p->gp_free_word = 0;
+    memset(p->gp_freemap, 0, words*sizeof(unsigned int));
+    /* The bits after the last slot are never free */
+    if (p->gp_size % BITS_IN_UINT)
+        p->gp_freemap[words-1] = ~0U << (p->gp_size % BITS_IN_UINT);
+}
+
+/* The free list of a type has the old pools with free slots, so
+   an allocation does not have to walk the whole pool chain */
+static void
+akl_gc_pool_add_free(struct akl_gc_type *t, struct akl_gc_pool *p)
+{
+    if (p->gp_in_free)
+        return;
+    p->gp_free_prev = NULL;
+    p->gp_free_next = t->gt_free;
+    if (t->gt_free)
+        t->gt_free->gp_free_prev = p;
+    t->gt_free = p;
+    p->gp_in_free = TRUE;
+}
+
+static void
+akl_gc_pool_del_free(struct akl_gc_type *t, struct akl_gc_pool *p)
+{
+    if (!p->gp_in_free)
+        return;
+    if (p->gp_free_prev)
+        p->gp_free_prev->gp_free_next = p->gp_free_next;
+    else
+        t->gt_free = p->gp_free_next;
+    if (p->gp_free_next)
+        p->gp_free_next->gp_free_prev = p->gp_free_prev;
+    p->gp_free_next = p->gp_free_prev = NULL;
+    p->gp_in_free = FALSE;
+}
+
+/* Append the pool to the (old) pool chain of the type */
+static void
+akl_gc_pool_link(struct akl_gc_type *t, struct akl_gc_pool *p)
+{
+    p->gp_next = NULL;
+    if (t->gt_pool_last)
+        t->gt_pool_last->gp_next = p;
+    if (t->gt_pool_head == NULL)
+        t->gt_pool_head = p;
+    t->gt_pool_last = p;
+    if (akl_gc_pool_have_free(p))
+        akl_gc_pool_add_free(t, p);
+}
+
+/* Free the dead young objects. The objects cannot be moved, so a pool
+   is only promoted, if its survivors use AKL_GC_PROMOTE_PERCENT of it.
+   The sparse pools are kept at the start of the nursery (their
+   survivors are old, they stay marked), so the next objects fill the
+   free slots of them. The empty pools are after them. */
+static void akl_gc_sweep_nursery(struct akl_state *s, struct akl_gc_type *t)
+{
+    struct akl_gc_pool *p, *next;
+    struct akl_gc_pool *kept = NULL, *kept_last = NULL;
+    struct akl_gc_pool *empty = NULL, *empty_last = NULL;
+
+    for (p = t->gt_nursery; p != NULL; p = next) {
+        next = p->gp_next;
+        if (p->gp_count != 0)
+            akl_gc_sweep_pool_slots(s, p, t->gt_destructor_fn);
+        if (p->gp_count == 0) {
+            akl_gc_pool_reset(p);
+            if (empty_last)
+                empty_last->gp_next = p;
+            else
+                empty = p;
+            empty_last = p;
+        } else if (p->gp_count*100 >= p->gp_size*AKL_GC_PROMOTE_PERCENT) {
+            akl_gc_pool_link(t, p);
+            s->ai_gc_promoted += p->gp_bytes;
+        } else {
+            if (p->gp_count > p->gp_old)
+                s->ai_gc_promoted += (p->gp_count - p->gp_old)*p->gp_objsize;
+            p->gp_old = p->gp_count;
+            p->gp_top = 0;
+            if (kept_last)
+                kept_last->gp_next = p;
+            else
+                kept = p;
+            kept_last = p;
+        }
+    }
+    if (empty_last)
+        empty_last->gp_next = NULL;
+    if (kept_last)
+        kept_last->gp_next = empty;
+    else
+        kept = empty;
+    t->gt_nursery     = kept;
+    t->gt_nursery_cur = kept;
+}
+
+static void akl_gc_minor(struct akl_context *ctx)
+{
+    struct akl_state *s = ctx->cx_state;
+    unsigned long start = akl_gc_usec(), pause;
+    int i;
+
+    akl_gc_mark_roots(ctx);
+    akl_gc_mark_remembered(s);
+    for (i = 0; i < akl_vector_count(&s->ai_gc_types); i++)
+        akl_gc_sweep_nursery(s, akl_gc_get_type(s, i));
+
+    pause = akl_gc_usec() - start;
+    s->ai_gc_minor_time += pause;
+    if (pause > s->ai_gc_minor_max)
+        s->ai_gc_minor_max = pause;
+    s->ai_gc_minors++;
+}
+
+static void akl_gc_major(struct akl_context *ctx)
+{
+    struct akl_state *s = ctx->cx_state;
+    unsigned long start = akl_gc_usec(), pause;
+
+    akl_gc_unmark_all(s);
+    akl_gc_forget_remembered(s);
+    akl_gc_mark_roots(ctx);
+    akl_gc_sweep(s);
+    s->ai_gc_promoted = 0;
+
+    pause = akl_gc_usec() - start;
+    s->ai_gc_full_time += pause;
+    if (pause > s->ai_gc_full_max)
+        s->ai_gc_full_max = pause;
+    s->ai_gc_collections++;
+}
+
+static void akl_gc_pool_unmark(struct akl_gc_pool *p, unsigned int n)
+{
+    struct akl_gc_generic_object *go;
+    unsigned int i;
+    for (i = 0; i < n; i++) {
+        go = (struct akl_gc_generic_object *)AKL_GC_POOL_AT(p, i);
+        AKL_GC_SET_MARK(go, FALSE);
+    }
+}
+
+/*
+ * With the incremental-gc feature, the full collection is done in
+ * slices at the safe points of the executor, between the instructions
+ * of the program:
+ * CLEAR: The marks of the old pools are cleared, pool by pool (the
+ *        ones of the kept nursery pools at the start of the cycle).
+ * MARK:  The roots are marked, then the gray objects are scanned.
+ *        The write barrier remembers the marked objects, which got a
+ *        new reference, they are scanned again. At the end, the roots
+ *        are marked again (the stacks have no barrier), the rest of
+ *        the gray objects are scanned at once and the nursery is swept.
+ * SWEEP: The old pools are swept, pool by pool.
+ * No minor collection can run in the clear and mark phases (it would
+ * mark the old objects), so the nursery grows. Over the threshold, the
+ * budget of a slice grows with the nursery (n times the threshold
+ * gives n+1 times the budget), so the marking catches up with the
+ * program, and the slices are still bounded.
+ * A slice ends after gc-slice-objects units of work (scanned objects,
+ * list entries and pool slots), or after gc-slice-usecs microseconds.
+ */
+static void akl_gc_start_cycle(struct akl_state *s)
+{
+    struct akl_gc_type *t;
+    struct akl_gc_pool *p;
+    int i;
+    for (i = 0; i < akl_vector_count(&s->ai_gc_types); i++) {
+        t = akl_gc_get_type(s, i);
+        t->gt_sweep      = t->gt_pool_head;
+        t->gt_sweep_prev = NULL;
+        /* The old objects of the kept nursery pools (right after
+           a minor collection, the nursery has no young objects) */
+        for (p = t->gt_nursery; p != NULL; p = p->gp_next)
+            if (p->gp_count != 0)
+                akl_gc_pool_unmark(p, p->gp_size);
+    }
+    s->ai_gc_cursor_type = 0;
+    s->ai_gc_phase = AKL_GC_PHASE_CLEAR;
+}
+
+/* The next type, which has pools to clear or sweep */
+static struct akl_gc_type *akl_gc_cursor_type(struct akl_state *s)
+{
+    struct akl_gc_type *t;
+    while (s->ai_gc_cursor_type < akl_vector_count(&s->ai_gc_types)) {
+        t = akl_gc_get_type(s, s->ai_gc_cursor_type);
+        if (t->gt_sweep != NULL)
+            return t;
+        s->ai_gc_cursor_type++;
+    }
+    return NULL;
+}
+
+static void akl_gc_start_mark(struct akl_context *ctx)
+{
+    struct akl_state *s = ctx->cx_state;
+    /* Everything is marked from the roots */
+    akl_gc_forget_remembered(s);
+    s->ai_gc_phase = AKL_GC_PHASE_MARK;
+    akl_gc_mark_roots(ctx);
+}
+
+static void akl_gc_finish_mark(struct akl_context *ctx)
+{
+    struct akl_state *s = ctx->cx_state;
+    struct akl_gc_type *t;
+    void *obj;
+    int i;
+
+    akl_gc_mark_roots(ctx);
+    while (s->ai_gc_remembered.av_count != 0 || s->ai_gc_gray.av_count != 0) {
+        akl_gc_mark_remembered(s);
+        while (s->ai_gc_gray.av_count != 0) {
+            obj = *(void **)akl_vector_pop(&s->ai_gc_gray);
+            akl_gc_scan_gray(s, obj);
+        }
+    }
+    /* The marking is done, the young objects are also swept */
+    s->ai_gc_phase = AKL_GC_PHASE_SWEEP;
+    for (i = 0; i < akl_vector_count(&s->ai_gc_types); i++) {
+        t = akl_gc_get_type(s, i);
+        akl_gc_sweep_nursery(s, t);
+        t->gt_sweep      = t->gt_pool_head;
+        t->gt_sweep_prev = NULL;
+    }
+    s->ai_gc_cursor_type = 0;
+    s->ai_gc_allocated   = 0;
+    s->ai_gc_promoted    = 0;
+}
+
+static bool_t akl_gc_slice_is_over(struct akl_state *s, unsigned long start
+                                   , unsigned int n, unsigned long scale)
+{
+    if (s->ai_gc_slice_objects != 0
+            && s->ai_gc_work >= scale*s->ai_gc_slice_objects)
+        return TRUE;
+    /* Do not read the clock after every object */
+    if (s->ai_gc_slice_usecs != 0 && (n % 64) == 0
+            && akl_gc_usec() - start >= scale*s->ai_gc_slice_usecs)
+        return TRUE;
+    return FALSE;
+}
+
+/* Do a slice of the incremental collection */
+static void akl_gc_step(struct akl_context *ctx)
+{
+    struct akl_state *s = ctx->cx_state;
+    struct akl_gc_type *t;
+    unsigned long start = akl_gc_usec(), pause;
+    unsigned long scale = 1;
+    unsigned int n = 0;
+    void *obj;
+
+    /* The nursery is over the threshold (see above) */
+    if (s->ai_gc_phase != AKL_GC_PHASE_SWEEP && s->ai_gc_threshold != 0)
+        scale += s->ai_gc_allocated/s->ai_gc_threshold;
+    s->ai_gc_work = 0;
+    do {
+        switch (s->ai_gc_phase) {
+            case AKL_GC_PHASE_CLEAR:
+            if ((t = akl_gc_cursor_type(s)) != NULL) {
+                akl_gc_pool_unmark(t->gt_sweep, t->gt_sweep->gp_size);
+                s->ai_gc_work += t->gt_sweep->gp_size;
+                t->gt_sweep = t->gt_sweep->gp_next;
+            } else {
+                akl_gc_start_mark(ctx);
+            }
+            break;
+
+            case AKL_GC_PHASE_MARK:
+            if (s->ai_gc_remembered.av_count != 0) {
+                akl_gc_mark_remembered(s);
+            } else if (s->ai_gc_gray.av_count != 0) {
+                obj = *(void **)akl_vector_pop(&s->ai_gc_gray);
+                akl_gc_scan_gray(s, obj);
+            } else {
+                akl_gc_finish_mark(ctx);
+            }
+            break;
+
+            case AKL_GC_PHASE_SWEEP:
+            if ((t = akl_gc_cursor_type(s)) != NULL) {
+                s->ai_gc_work += t->gt_sweep->gp_size;
+                akl_gc_sweep_old_pool(s, t);
+            } else {
+                s->ai_gc_phase = AKL_GC_PHASE_IDLE;
+                s->ai_gc_collections++;
+            }
+            break;
 
+            default:
+            break;
+        }
+    } while (s->ai_gc_phase != AKL_GC_PHASE_IDLE
+             && !akl_gc_slice_is_over(s, start, ++n, scale));
+
+    pause = akl_gc_usec() - start;
+    if (pause > s->ai_gc_slice_max)
+        s->ai_gc_slice_max = pause;
+    s->ai_gc_slices++;
 }
 
+/* Collect the unreachable objects, ctx is the running context.
+   The executor calls this at its safe points (calls and backward
+   jumps), when enough memory was allocated since the last run,
+   or when an incremental collection is in progress. */
+void akl_gc_collect(struct akl_context *ctx)
+{
+    struct akl_state *s = ctx->cx_state;
+    bool_t gen = AKL_IS_FEATURE_ON(s, AKL_CFG_GEN_GC);
+
+    if (!AKL_IS_FEATURE_ON(s, AKL_CFG_USE_GC)) {
+        s->ai_gc_allocated = 0;
+        return;
+    }
+
+    if (s->ai_gc_phase != AKL_GC_PHASE_IDLE) {
+        akl_gc_step(ctx);
+        if (s->ai_gc_phase != AKL_GC_PHASE_SWEEP
+                && s->ai_gc_phase != AKL_GC_PHASE_IDLE)
+            return;
+    }
+    if (s->ai_gc_allocated < s->ai_gc_threshold)
+        return;
+
+    s->ai_gc_allocated = 0;
+    if (gen)
+        akl_gc_minor(ctx);
+    if (s->ai_gc_phase == AKL_GC_PHASE_IDLE
+            && (!gen || s->ai_gc_promoted >= s->ai_gc_major_threshold)) {
+        /* The incremental collection needs the nursery, since the
+           program cannot allocate in the pools, which are swept */
+        if (gen && AKL_IS_FEATURE_ON(s, AKL_CFG_INCR_GC))
+            akl_gc_start_cycle(s);
+        else
+            akl_gc_major(ctx);
+    }
+}
+
+void akl_gc_mark_all(struct akl_state *s)
+{
+    if (!AKL_IS_FEATURE_ON(s, AKL_CFG_USE_GC)) 
+        return;
+    akl_gc_mark(s);
+}
+
+/* Clear the marks of every allocated object (before a full collection) */
 void akl_gc_unmark_all(struct akl_state *s)
 {
+    struct akl_gc_type *t;
+    struct akl_gc_pool *p;
+    int i;
     if (!AKL_IS_FEATURE_ON(s, AKL_CFG_USE_GC)) 
         return;
+    for (i = 0; i < akl_vector_count(&s->ai_gc_types); i++) {
+        t = akl_gc_get_type(s, i);
+        for (p = t->gt_pool_head; p != NULL; p = p->gp_next)
+            akl_gc_pool_unmark(p, p->gp_size);
+        /* The kept pools can have old objects after the top */
+        for (p = t->gt_nursery; p != NULL; p = p->gp_next)
+            if (p->gp_count != 0)
+                akl_gc_pool_unmark(p, p->gp_size);
+    }
 }
 
-#define ASSERT_INDEX(ind) \
-    assert(ind < AKL_GC_POOL_SIZE*(sizeof(unsigned int)*8))
+#define ASSERT_INDEX(p, ind) assert((ind) < (p)->gp_size)
 
 bool_t akl_gc_pool_in_use(struct akl_gc_pool *p, unsigned int ind)
 {
     assert(p);
-    ASSERT_INDEX(ind);
-//    int i = ind/BITS_IN_UINT;
+    ASSERT_INDEX(p, ind);
     return IS_BIT_SET(BIT_INDEX(p->gp_freemap, ind), ind);
 }
 
 void akl_gc_pool_use(struct akl_gc_pool *p, unsigned int ind)
 {
     assert(p);
-    ASSERT_INDEX(ind);
-    p->gp_pool.av_count++;
+    ASSERT_INDEX(p, ind);
+    p->gp_count++;
     SET_BIT(BIT_INDEX(p->gp_freemap, ind), ind);
 }
 
 void akl_gc_pool_clear_use(struct akl_gc_pool *p, unsigned int ind)
 {
     assert(p);
-    ASSERT_INDEX(ind);
-    p->gp_pool.av_count--;
+    ASSERT_INDEX(p, ind);
+    p->gp_count--;
     CLEAR_BIT(BIT_INDEX(p->gp_freemap, ind), ind);
+    if (ind/BITS_IN_UINT < p->gp_free_word)
+        p->gp_free_word = ind/BITS_IN_UINT;
 }
 
 bool_t akl_gc_pool_have_free(struct akl_gc_pool *p)
 {
-    int i;
     assert(p);
-    for (i = 0; i < AKL_GC_POOL_SIZE/BITS_IN_UINT; i++) {
-        if (p->gp_freemap[i] != UINT_MAX) {
-            return TRUE;
-        }
-    }
-    return FALSE;
+    return p->gp_count < p->gp_size;
 }
 
+/* The search starts at the first word, which can have a free slot */
 int akl_gc_pool_find_free(struct akl_gc_pool *p)
 {
-    int i, j;
+    unsigned int i, free, words;
     assert(p);
-    /* Is the next element is usable? */
-    int cnt = akl_vector_count(&p->gp_pool);
-    if (cnt < AKL_GC_POOL_SIZE && !akl_gc_pool_in_use(p, cnt))
-        return cnt;
-
-    /* Nope... */
-    for (i = 0; i < AKL_GC_POOL_SIZE/BITS_IN_UINT; i++) {
-        if (p->gp_freemap[i] != UINT_MAX) {
-            for (j = 0; j < BITS_IN_UINT; j++) {
-                if (IS_BIT_NOT_SET(p->gp_freemap[i], j))
-                    return j;
-            }
+    words = POOL_WORDS(p->gp_size);
+    for (i = p->gp_free_word; i < words; i++) {
+        free = ~p->gp_freemap[i];
+        if (free != 0) {
+            p->gp_free_word = i;
+            return i*BITS_IN_UINT + FIRST_BIT(free);
         }
     }
+    p->gp_free_word = words;
     return -1;
 }
 
-static bool_t 
-akl_gc_type_have_free(struct akl_state *s, struct akl_gc_type *t, struct akl_gc_pool **pool, unsigned int *ind)
+bool_t akl_gc_pool_is_empty(struct akl_gc_pool *p)
 {
-    struct akl_gc_pool *p = t->gt_pool_head;
-    int i;
-    /* The last pool should have some free room (small optimization) */
+    assert(p);
+    return p->gp_count == 0;
+}
+
+/* Get the pages of a new pool, the header is at the start of them */
+static struct akl_gc_pool *akl_gc_pool_alloc(struct akl_state *s, size_t bytes)
+{
+    struct akl_gc_pool *p = akl_alloc_pages(s, bytes);
     if (p == NULL) {
-        *pool = akl_gc_pool_create(s, t);
-        *ind = 0;
-        return TRUE;
-    }
+        switch (s->ai_mem_fn->mc_nomem_fn(s)) {
+            case AKL_NM_TRYAGAIN:
+            return akl_gc_pool_alloc(s, bytes);
 
-    if (akl_gc_pool_have_free(t->gt_pool_last)) {
-        *ind = akl_gc_pool_find_free(t->gt_pool_last);
-        *pool = t->gt_pool_last;
-        return TRUE;
-    }
+            case AKL_NM_TERMINATE:
+            exit(1); // FALLTHROUGH
 
-    /* Ok. We have to check the others too :-( */
-    while (p && p != t->gt_pool_last) { /* The last was already checked... */
-        /* TODO: Rework this */
-        if (akl_gc_pool_have_free(p)) {
-            i = akl_gc_pool_find_free(p);
-            *pool = p;
-            if (i == -1) {
-                continue;
-            }
-            return TRUE;
+            case AKL_NM_RETNULL:
+            return NULL;
         }
-        p = p->gp_next;
-    }
-    return FALSE;
-}
-
-bool_t akl_gc_pool_is_empty(struct akl_gc_pool *p)
-{
-    assert(p);
-    int i, s = 0;
-    for (i = 0; i < AKL_GC_POOL_SIZE/BITS_IN_UINT; i++) {
-        s += p->gp_freemap[i];
     }
-    return s == 0;
+    s->ai_gc_malloc_size += bytes;
+    return p;
 }
 
 void akl_gc_pool_free(struct akl_state *s, struct akl_gc_pool *p)
 {
-    akl_vector_destroy(s, &p->gp_pool);
-    akl_free(s, p->gp_freemap, AKL_GC_POOL_SIZE/BITS_IN_UINT);
-    AKL_FREE(s, p);
+    s->ai_gc_malloc_size -= p->gp_bytes;
+    akl_free_pages(s, p, p->gp_bytes);
 }
 
 bool_t akl_gc_type_tryfree(struct akl_state *s, struct akl_gc_type *t)
@@ -396,10 +1072,14 @@ bool_t akl_gc_type_tryfree(struct akl_state *s, struct akl_gc_type *t)
             succeed = TRUE;
             if (prev)
                 prev->gp_next = next;
+            else
+                t->gt_pool_head = next;
 
             /* This was the last pool, update the 'last' pointer */
             if (next == NULL)
                 t->gt_pool_last = prev;
+            akl_gc_pool_del_free(t, p);
+            t->gt_pool_count--;
             akl_gc_pool_free(s, p);
         } else {
             prev = p;
@@ -421,26 +1101,93 @@ bool_t akl_gc_tryfree(struct akl_state *s)
     return succeed;
 }
 
-void akl_gc_sweep_pool(struct akl_state *s, struct akl_gc_pool *p, akl_gc_marker_t marker)
+/* Free the unmarked objects of the pool. The marks of the others
+   are kept, they are the old objects from now on. The destructor
+   (if any) is called on every freed object. */
+static void akl_gc_sweep_pool_slots(struct akl_state *s, struct akl_gc_pool *p
+                                    , akl_gc_destructor_t destroy)
 {
-    struct akl_vector *v;
     struct akl_gc_generic_object *go;
-    int i;
-    if (!p || !marker)
-        return;
-
-    v = &p->gp_pool;
-    for (i = 0; i < AKL_GC_POOL_SIZE; i++) {
-        go = (struct akl_gc_generic_object *)akl_vector_at(v, i);
-        if (akl_gc_pool_in_use(p, i)) {
-            if (AKL_GC_IS_MARKED(go)) {
-                marker(s, go, FALSE);
-            } else {
-                akl_gc_pool_clear_use(p, i);
+    unsigned int i, j, used, dead;
+    /* Only visit the used slots, and free the dead ones word by word */
+    for (i = 0; i < POOL_WORDS(p->gp_size); i++) {
+        dead = 0;
+        for (used = p->gp_freemap[i]; used != 0; used &= used - 1) {
+            j = FIRST_BIT(used);
+            if (i*BITS_IN_UINT + j >= p->gp_size)
+                break;
+            go = (struct akl_gc_generic_object *)AKL_GC_POOL_AT(p, i*BITS_IN_UINT + j);
+            if (!AKL_GC_IS_MARKED(go) && !go->gc_obj.gc_static) {
+                dead |= BIT_MASK(j);
+                if (destroy != NULL)
+                    destroy(s, go);
             }
         }
+        if (dead == 0)
+            continue;
+        p->gp_freemap[i] &= ~dead;
+        p->gp_count -= COUNT_BITS(dead);
+        if (i < p->gp_free_word)
+            p->gp_free_word = i;
     }
-    akl_gc_sweep_pool(s, p->gp_next, marker);
+}
+
+void akl_gc_sweep_pool(struct akl_state *s, struct akl_gc_pool *p, akl_gc_marker_t marker)
+{
+    for (; p != NULL; p = p->gp_next)
+        akl_gc_sweep_pool_slots(s, p, NULL);
+}
+
+/* Sweep the next old pool (t->gt_sweep), the emptied
+   pools are given back to the nursery */
+static void akl_gc_sweep_old_pool(struct akl_state *s, struct akl_gc_type *t)
+{
+    struct akl_gc_pool *p = t->gt_sweep;
+    struct akl_gc_pool *prev = t->gt_sweep_prev;
+
+    t->gt_sweep = p->gp_next;
+    akl_gc_sweep_pool_slots(s, p, t->gt_destructor_fn);
+    if (!AKL_IS_FEATURE_ON(s, AKL_CFG_GEN_GC)
+            || p->gp_count != 0) {
+        if (akl_gc_pool_have_free(p))
+            akl_gc_pool_add_free(t, p);
+        t->gt_sweep_prev = p;
+        return;
+    }
+    akl_gc_pool_del_free(t, p);
+    if (prev)
+        prev->gp_next = p->gp_next;
+    else
+        t->gt_pool_head = p->gp_next;
+    if (t->gt_pool_last == p)
+        t->gt_pool_last = prev;
+
+    akl_gc_pool_reset(p);
+    if (t->gt_nursery_cur != NULL) {
+        p->gp_next = t->gt_nursery_cur->gp_next;
+        t->gt_nursery_cur->gp_next = p;
+    } else {
+        p->gp_next = NULL;
+        t->gt_nursery = t->gt_nursery_cur = p;
+    }
+}
+
+/* Finish the sweep phase of the incremental collection */
+static void akl_gc_finish_sweep(struct akl_state *s)
+{
+    struct akl_gc_type *t;
+    while ((t = akl_gc_cursor_type(s)) != NULL)
+        akl_gc_sweep_old_pool(s, t);
+    s->ai_gc_phase = AKL_GC_PHASE_IDLE;
+    s->ai_gc_collections++;
+}
+
+static void akl_gc_sweep_old(struct akl_state *s, struct akl_gc_type *t)
+{
+    t->gt_sweep      = t->gt_pool_head;
+    t->gt_sweep_prev = NULL;
+    while (t->gt_sweep != NULL)
+        akl_gc_sweep_old_pool(s, t);
 }
 
 void akl_gc_sweep(struct akl_state *s)
@@ -450,7 +1197,8 @@ void akl_gc_sweep(struct akl_state *s)
     if (AKL_IS_FEATURE_ON(s, AKL_CFG_USE_GC)) {
         for (i = 0; i < akl_vector_count(&s->ai_gc_types); i++) {
             t = akl_gc_get_type(s, i);
-            akl_gc_sweep_pool(s, t->gt_pool_head, t->gt_marker_fn);
+            akl_gc_sweep_nursery(s, t);
+            akl_gc_sweep_old(s, t);
         }
     }
 }
@@ -476,30 +1224,53 @@ struct akl_gc_type *akl_gc_get_type(struct akl_state *s, akl_gc_type_t type)
     return (struct akl_gc_type *)akl_vector_at(&s->ai_gc_types, type);
 }
 
-struct akl_gc_pool *akl_gc_pool_create(struct akl_state *s, struct akl_gc_type *type)
+static struct akl_gc_pool *akl_gc_pool_new(struct akl_state *s, struct akl_gc_type *type)
 {
-    struct akl_gc_pool *pool = AKL_MALLOC(s, struct akl_gc_pool);
-    pool->gp_next = NULL;
-    akl_init_vector(s, &pool->gp_pool, AKL_GC_POOL_SIZE, type->gt_type_size);
-    memset(pool->gp_freemap, 0, AKL_GC_POOL_SIZE/BITS_IN_UINT);
-
-    if (type->gt_pool_last)
-        type->gt_pool_last->gp_next = pool;
-
-    if (type->gt_pool_head == NULL)
-        type->gt_pool_head = pool;
-
-    type->gt_pool_last = pool;
+    struct akl_gc_pool *pool = akl_gc_pool_alloc(s, type->gt_pool_bytes);
+    pool->gp_next    = NULL;
+    pool->gp_objects = (char *)pool + akl_gc_pool_offset(type->gt_pool_slots);
+    pool->gp_objsize = type->gt_type_size;
+    pool->gp_bytes   = type->gt_pool_bytes;
+    pool->gp_size    = type->gt_pool_slots;
+    pool->gp_free_next = pool->gp_free_prev = NULL;
+    pool->gp_in_free = FALSE;
+    akl_gc_pool_reset(pool);
     type->gt_pool_count++;
     return pool;
 }
 
-// TODO: Implement akl_gc_mark_function and akl_gc_mark_udata
+struct akl_gc_pool *akl_gc_pool_create(struct akl_state *s, struct akl_gc_type *type)
+{
+    struct akl_gc_pool *pool = akl_gc_pool_new(s, type);
+    akl_gc_pool_link(type, pool);
+    return pool;
+}
+
+/* Step to the next (empty) pool of the nursery, or make a new one */
+static struct akl_gc_pool *akl_gc_nursery_next(struct akl_state *s, struct akl_gc_type *t)
+{
+    struct akl_gc_pool *p = t->gt_nursery_cur;
+    if (p != NULL && p->gp_next != NULL) {
+        p = p->gp_next;
+    } else if (p != NULL) {
+        p->gp_next = akl_gc_pool_new(s, t);
+        p = p->gp_next;
+    } else {
+        p = t->gt_nursery = akl_gc_pool_new(s, t);
+    }
+    t->gt_nursery_cur = p;
+    return p;
+}
+
 const akl_gc_marker_t base_type_markers[] = {
     akl_gc_mark_value, akl_gc_mark_variable, akl_gc_mark_list, akl_gc_mark_list_entry
   , akl_gc_mark_function, akl_gc_mark_udata
 };
 
+const akl_gc_destructor_t base_type_destructors[] = {
+    NULL, NULL, NULL, NULL, akl_gc_free_function, NULL
+};
+
 const size_t base_type_sizes[] = {
     sizeof(struct akl_value), sizeof(struct akl_variable), sizeof(struct akl_list)
   , sizeof(struct akl_list_entry), sizeof(struct akl_function)
@@ -509,13 +1280,32 @@ const size_t base_type_sizes[] = {
 void akl_gc_init(struct akl_state *s)
 {
     int i;
-    s->ai_gc_last_was_mark = FALSE;
     s->ai_gc_malloc_size = 0;
+    s->ai_gc_allocated   = 0;
+    s->ai_gc_threshold   = AKL_GC_THRESHOLD;
+    s->ai_gc_promoted    = 0;
+    s->ai_gc_major_threshold = AKL_GC_MAJOR_THRESHOLD;
+    s->ai_gc_collections = 0;
+    s->ai_gc_minors      = 0;
+    s->ai_gc_minor_time  = 0;
+    s->ai_gc_minor_max   = 0;
+    s->ai_gc_full_time   = 0;
+    s->ai_gc_full_max    = 0;
+    akl_init_vector(s, &s->ai_gc_remembered, 0, sizeof(void *));
+    s->ai_gc_phase       = AKL_GC_PHASE_IDLE;
+    akl_init_vector(s, &s->ai_gc_gray, 0, sizeof(void *));
+    s->ai_gc_cursor_type = 0;
+    s->ai_gc_work        = 0;
+    s->ai_gc_slice_objects = AKL_GC_SLICE_OBJECTS;
+    s->ai_gc_slice_usecs = 0;
+    s->ai_gc_slices      = 0;
+    s->ai_gc_slice_max   = 0;
 
     akl_gc_disable(s);
     akl_init_vector(s, &s->ai_gc_types, AKL_GC_NR_BASE_TYPES, sizeof(struct akl_gc_type));
     for (i = 0; i < AKL_GC_NR_BASE_TYPES; i++) {
-        akl_gc_register_type(s, base_type_markers[i], base_type_sizes[i]);
+        akl_gc_register_type(s, base_type_markers[i], base_type_sizes[i], 0);
+        akl_gc_get_type(s, i)->gt_destructor_fn = base_type_destructors[i];
     }
 }
 /**
@@ -523,8 +1313,8 @@ void akl_gc_init(struct akl_state *s)
  * @param s An instance of the interpreter (cannot be NULL)
  * @param type Type of the GC object
  * @see AKL_GC_OBJECT_TYPE
- * If the claim is not met, try to collect some memory or
- * create a new GC pool.
+ * The object is allocated in the nursery (by bumping its pointer),
+ * or with the gen-gc feature turned off, in a free slot of the pools.
 */
 void *akl_gc_malloc(struct akl_state *s, akl_gc_type_t tid)
 {
@@ -532,26 +1322,36 @@ void *akl_gc_malloc(struct akl_state *s, akl_gc_type_t tid)
     struct akl_gc_type *t = akl_gc_get_type(s, tid);
     struct akl_gc_pool *p;
     unsigned int ind;
-    if (akl_gc_type_have_free(s, t, &p, &ind)) {
-        /* This was too easy... */
-        akl_gc_pool_use(p, ind);
-        return akl_vector_at(&p->gp_pool, ind);
-    } else {
-        if (!s->ai_gc_last_was_mark && AKL_IS_FEATURE_ON(s, AKL_CFG_USE_GC)) {
-            akl_gc_mark(s);
-            akl_gc_sweep(s);
-            s->ai_gc_last_was_mark = TRUE;
-            return akl_gc_malloc(s, tid);
-        } else {
-            /* We cannot collect enough memory :-( => we have to to some
-             * allocation. To do this we must also need to create the
-             * container pool (just for that type). */
-            p = akl_gc_pool_create(s, t);
-            s->ai_gc_last_was_mark = FALSE;
-            akl_gc_pool_use(p, 0);
-            return akl_vector_at(&p->gp_pool, 0);
+    /* The collection can only run at the safe points of the
+       executor (see akl_gc_collect()), where every live object
+       is reachable from the roots. Here just count the bytes. */
+    s->ai_gc_allocated += t->gt_type_size;
+    if (AKL_IS_FEATURE_ON(s, AKL_CFG_GEN_GC)) {
+        /* The bump allocation skips the survivors of a kept pool */
+        p = t->gt_nursery_cur;
+        for (;;) {
+            if (p == NULL || p->gp_top == p->gp_size)
+                p = akl_gc_nursery_next(s, t);
+            else if (akl_gc_pool_in_use(p, p->gp_top))
+                p->gp_top++;
+            else
+                break;
         }
+        akl_gc_pool_use(p, p->gp_top);
+        return AKL_GC_POOL_AT(p, p->gp_top++);
     }
+    /* The new object could be in a pool, which is not swept yet */
+    if (s->ai_gc_phase == AKL_GC_PHASE_SWEEP)
+        akl_gc_finish_sweep(s);
+    /* The first pool with free room, or a new one (just for that type) */
+    p = t->gt_free;
+    if (p == NULL)
+        p = akl_gc_pool_create(s, t);
+    ind = akl_gc_pool_find_free(p);
+    akl_gc_pool_use(p, ind);
+    if (!akl_gc_pool_have_free(p))
+        akl_gc_pool_del_free(t, p);
+    return AKL_GC_POOL_AT(p, ind);
 }
 
 /* ~~~===### Free functions ###===~~~ */
@@ -221,6 +221,56 @@ size_t copy_word(struct akl_io_device *dev)
     return i;
 }
 
+/* Skip the rest of a list after its left brace, without making
+ * tokens from it (only the strings and comments are recognized).
+ * Gives FALSE, if the input ended before the closing brace.
+*/
+bool_t akl_lex_skip_list(struct akl_io_device *dev)
+{
+    int ch;
+    int depth = 1;
+    bool_t in_string = FALSE;
+    assert(dev);
+
+    while ((ch = akl_io_getc(dev)) != EOF && ch != '\0') {
+        if (ch == '\n') {
+            dev->iod_line_count++;
+            dev->iod_char_count = 0;
+        }
+        if (in_string) {
+            if (ch == '\\')
+                akl_io_getc(dev);
+            else if (ch == '"')
+                in_string = FALSE;
+            continue;
+        }
+        switch (ch) {
+            case '"':
+            in_string = TRUE;
+            break;
+
+            case ';':
+            while ((ch = akl_io_getc(dev)) != '\n') {
+                if (ch == EOF || ch == '\0')
+                    return FALSE;
+            }
+            dev->iod_line_count++;
+            dev->iod_char_count = 0;
+            break;
+
+            case '(':
+            depth++;
+            break;
+
+            case ')':
+            if (--depth == 0)
+                return TRUE;
+            break;
+        }
+    }
+    return FALSE;
+}
+
 /* Pushes tok back to the token stream.
  * The next call of akl_lex(), instead of reading the input
  * it will give back the token specified here. Similiar to ungetc().
@@ -316,6 +366,8 @@ akl_lex(struct akl_io_device *dev)
                 if (akl_io_eof(dev))
                     return tEOF;
             }
+            dev->iod_line_count++;
+            dev->iod_char_count = 0;
         } else if (isalpha(ch) || ispunct(ch)) {
             if (op == '+' || op == '-') {
                 akl_io_ungetc(op, dev);
@@ -134,8 +134,20 @@ AKL_DEFINE_FUN(akl_cfg, cx, argc)
 {
     struct akl_symbol *sym;
     const char *sname;
+    double value;
     struct akl_state *s = cx->cx_state;
-    if (akl_get_args_strict(cx, 1, AKL_VT_OPT, AKL_VT_SYMBOL, &sym) == -1) {
+    /* Numeric setting: (akl-cfg! :gc-threshold 1000000) */
+    if (argc == 2) {
+        if (akl_get_args_strict(cx, 2, AKL_VT_SYMBOL, &sym, AKL_VT_NUMBER, &value) == -1)
+            return AKL_NIL;
+        if (value < 0 || !akl_set_setting(s, sym->sb_name, (unsigned long)value)) {
+            akl_raise_error(cx, AKL_WARNING, "Cannot set '%s'", sym->sb_name);
+            return AKL_NIL;
+        }
+        return AKL_TRUE;
+    }
+    /* Feature: (akl-cfg! :use-gc) or (akl-cfg! :no-use-gc) */
+    if (argc != 1 || akl_get_args_strict(cx, 1, AKL_VT_SYMBOL, &sym) == -1) {
        show_features(s, cx->cx_func_name);
        return AKL_NIL;
     }
@@ -167,7 +179,7 @@ formatted_display(struct akl_context *ctx)
 {
     struct akl_value *v;
     while ((v = akl_frame_shift(ctx)) != NULL) {
-        switch (v->va_type) {
+        switch (AKL_TYPE(v)) {
             case AKL_VT_NUMBER:
             printf("%g", AKL_GET_NUMBER_VALUE(v));
             break;
@@ -340,14 +352,12 @@ AKL_DEFINE_FUN(hello, cx, argc)
 
 AKL_DEFINE_FUN(dump_stack, cx, argc)
 {
-    struct akl_value *v;
-    struct akl_list_entry *ent;
-    int n = 0;
+    struct akl_value **vp;
+    unsigned int n;
     printf("stack contents:\n");
-    AKL_LIST_FOREACH(ent, cx->cx_stack) {
-        v = (struct akl_value *)ent->le_data;
+    AKL_VECTOR_FOREACH(n, vp, cx->cx_stack) {
         printf("%%%d: ", n);
-        akl_print_value(cx->cx_state, v);
+        akl_print_value(cx->cx_state, *vp);
         printf("\n");
     }
     return AKL_NIL;
@@ -365,6 +375,22 @@ AKL_DEFINE_FUN(dump_vars, cx, argc)
     return AKL_NIL;
 }
 
+AKL_DEFINE_FUN(ic_stats, cx, argc)
+{
+    struct akl_state *s = cx->cx_state;
+    struct akl_list *l = akl_new_list(s);
+    struct akl_value *lv;
+    printf("inline caches: %lu hits, %lu misses\n"
+           , s->ai_ic_hits, s->ai_ic_misses);
+    akl_list_append_value(s, l, AKL_NUMBER(cx, s->ai_ic_hits));
+    akl_list_append_value(s, l, AKL_NUMBER(cx, s->ai_ic_misses));
+
+    lv = akl_new_list_value(s, l);
+    l->is_quoted  = TRUE;
+    lv->is_quoted = TRUE;
+    return lv;
+}
+
 static int
 get_and_compare_values(struct akl_context *ctx)
 {
@@ -636,7 +662,7 @@ AKL_DEFINE_FUN(ls_insert, ctx, argc)
         case AKL_VT_NIL:
         l = akl_new_list(ctx->cx_state);
         v = akl_new_list_value(ctx->cx_state, l);
-        akl_list_insert_head(ctx->cx_state, l, iv);
+        akl_list_insert_head_value(ctx->cx_state, l, iv);
         break;   break;
 
         case AKL_VT_LIST:
@@ -686,7 +712,7 @@ AKL_DEFINE_FUN(ls_append, ctx, argc)
         case AKL_VT_NIL:
         l = akl_new_list(ctx->cx_state);
         v = akl_new_list_value(ctx->cx_state, l);
-        akl_list_append(ctx->cx_state, l, iv);
+        akl_list_append_value(ctx->cx_state, l, iv);
         break;
 
         default:
@@ -717,7 +743,7 @@ AKL_DEFINE_FUN(map, ctx, argc)
     struct akl_function *fn;
     struct akl_list *lp, *nl;
     struct akl_list_entry *it;
-    struct akl_value *v;
+    struct akl_value *v, *lv;
     struct akl_context *cx;
     // TODO: Change TYPE_* to bit masks.
     if (akl_get_args_strict(ctx, 2, AKL_VT_LIST, &lp, AKL_VT_FUNCTION, &fn) == -1) {
@@ -725,15 +751,23 @@ AKL_DEFINE_FUN(map, ctx, argc)
     }
     it = akl_list_it_begin(lp);
     cx = akl_bound_function(ctx, NULL, fn);
+    if (cx == NULL)
+        return AKL_NIL;
     nl = akl_new_list(ctx->cx_state);
     nl->is_quoted = TRUE;
+    /* The called function can start a collection, so the new list
+       is kept on the stack, below the arguments of the calls */
+    lv = akl_new_list_value(ctx->cx_state, nl);
+    akl_stack_push(ctx, lv);
     while ((v = akl_list_it_next(&it)) != NULL) {
         akl_stack_push(ctx, v);
         akl_call_function_bound(cx, 1); /* TODO: How to go with more arguments? */
         akl_list_append_value(ctx->cx_state, nl, akl_stack_pop(ctx));
     }
+    akl_release_context(cx);
+    akl_stack_pop(ctx);
 
-    return akl_new_list_value(ctx->cx_state, nl);
+    return lv;
 }
 
 AKL_DEFINE_FUN(map_index, ctx, argc)
@@ -741,7 +775,7 @@ AKL_DEFINE_FUN(map_index, ctx, argc)
     struct akl_function *fn;
     struct akl_list *lp, *nl;
     struct akl_list_entry *it;
-    struct akl_value *v;
+    struct akl_value *v, *lv;
     struct akl_context *cx;
     int ind = 0;
     // TODO: Change TYPE_* to bit masks.
@@ -750,16 +784,22 @@ AKL_DEFINE_FUN(map_index, ctx, argc)
     }
     it = akl_list_it_begin(lp);
     cx = akl_bound_function(ctx, NULL, fn);
+    if (cx == NULL)
+        return AKL_NIL;
     nl = akl_new_list(ctx->cx_state);
     nl->is_quoted = TRUE;
+    lv = akl_new_list_value(ctx->cx_state, nl);
+    akl_stack_push(ctx, lv);
     while ((v = akl_list_it_next(&it)) != NULL) {
         akl_stack_push(ctx, AKL_NUMBER(ctx, ind++));
         akl_stack_push(ctx, v);
         akl_call_function_bound(cx, 1);
         akl_list_append_value(ctx->cx_state, nl, akl_stack_pop(ctx));
     }
+    akl_release_context(cx);
+    akl_stack_pop(ctx);
 
-    return akl_new_list_value(ctx->cx_state, nl);
+    return lv;
 }
 
 AKL_DEFINE_FUN(foldl, ctx, argc)
@@ -774,12 +814,15 @@ AKL_DEFINE_FUN(foldl, ctx, argc)
     }
     it = akl_list_it_begin(lp);
     cx = akl_bound_function(ctx, NULL, fn);
+    if (cx == NULL)
+        return AKL_NIL;
     while ((vl = akl_list_it_next(&it)) != NULL) {
         akl_stack_push(cx, v);
         akl_stack_push(cx, vl);
         akl_call_function_bound(cx, 2);
         v = akl_stack_pop(cx);
     }
+    akl_release_context(cx);
 
     return v;
 }
@@ -790,6 +833,7 @@ times_impl(struct akl_context *ctx, bool_t is_indexed)
     struct akl_function *fn;
     struct akl_context *cx;
     struct akl_list *nl;
+    struct akl_value *lv;
     int i;
     double times_arg;
     // TODO: Change TYPE_* to bit masks.
@@ -798,8 +842,12 @@ times_impl(struct akl_context *ctx, bool_t is_indexed)
        return AKL_NIL;
     }
     cx = akl_bound_function(ctx, NULL, fn);
+    if (cx == NULL)
+        return AKL_NIL;
     nl = akl_new_list(ctx->cx_state);
     nl->is_quoted = TRUE;
+    lv = akl_new_list_value(ctx->cx_state, nl);
+    akl_stack_push(ctx, lv);
     for (i = 0; i < (int)times_arg; i++) {
         if (is_indexed) {
             akl_stack_push(cx, AKL_NUMBER(cx, i));
@@ -807,8 +855,10 @@ times_impl(struct akl_context *ctx, bool_t is_indexed)
         akl_call_function_bound(cx, (is_indexed) ? 1 : 0);
         akl_list_append_value(ctx->cx_state, nl, akl_stack_pop(ctx));
     }
+    akl_release_context(cx);
+    akl_stack_pop(ctx);
 
-    return akl_new_list_value(ctx->cx_state, nl);
+    return lv;
 }
 
 AKL_DEFINE_FUN(times, ctx, argc)
@@ -865,6 +915,8 @@ AKL_DEFINE_FUN(disassemble, ctx, argc)
     } else {
         fn = ctx->cx_fn_main;
     }
+    if (fn->fn_type == AKL_FUNC_USER && fn->fn_body.ufun.uf_lazy != NULL)
+        akl_compile_lazy(ctx, fn);
     akl_dump_ir(ctx, fn);
     return AKL_NIL;
 }
@@ -979,6 +1031,15 @@ AKL_DEFINE_FUN(about, ctx, argc)
     }
     printf("\nGC statistics:\n");
     printf("\tallocated memory: %u bytes\n", s->ai_gc_malloc_size);
+    printf("\tcollections: %lu full, %lu minor (threshold: %lu bytes)\n"
+           , s->ai_gc_collections, s->ai_gc_minors, s->ai_gc_threshold);
+    printf("\tminor pauses: %lu us total, %lu us max\n"
+           , s->ai_gc_minor_time, s->ai_gc_minor_max);
+    printf("\tfull pauses: %lu us total, %lu us max\n"
+           , s->ai_gc_full_time, s->ai_gc_full_max);
+    if (s->ai_gc_slices != 0)
+        printf("\tincremental slices: %lu (%lu us max)\n"
+               , s->ai_gc_slices, s->ai_gc_slice_max);
 
     return &TRUE_VALUE;
 }
@@ -1024,37 +1085,6 @@ AKL_DEFINE_FUN(not, ctx, argc)
     return AKL_NIL;
 }
 
-AKL_DEFINE_FUN(and, ctx, argc)
-{
-    struct akl_value *v = NULL;
-    do {
-       v = akl_frame_pop(ctx);
-       if (v == NULL) {
-           break;
-       }
-       if (AKL_IS_NIL(v)) {
-           return AKL_NIL;
-       }
-
-    } while (v != NULL);
-    return AKL_TRUE;
-}
-
-AKL_DEFINE_FUN(or, ctx, argc)
-{
-    struct akl_value *v = NULL;
-    do {
-       v = akl_frame_pop(ctx);
-       if (v == NULL) {
-           break;
-       }
-       if (AKL_IS_TRUE(v)) {
-           return AKL_TRUE;
-       }
-    } while (v != NULL);
-    return AKL_NIL;
-}
-
 const char *akl_lex_get_filename(struct akl_io_device *dev);
 
 AKL_DEFINE_FUN(load, ctx, argc)
@@ -1092,7 +1122,9 @@ AKL_DEFINE_FUN(load, ctx, argc)
         akl_raise_error(ctx, AKL_ERROR, "Cannot load '%s', cannot open file.", fname);
         return AKL_NIL;
     }
-    dev = akl_new_file_device(ctx->cx_state, fname, fp);
+    /* The lexical informations of the code keep the name (and
+       the path is on the stack) */
+    dev = akl_new_file_device(ctx->cx_state, AKL_STRDUP(fname), fp);
     cx  = akl_compile(ctx->cx_state, dev);
     cx->cx_parent = ctx;
     akl_execute(cx);
@@ -2141,36 +2173,68 @@ static void akl_define_mod_path(struct akl_state *s)
 
 }
 
+/* Builtins with a dedicated instruction. The compiler uses them
+   instead of a call, while the builtin is not rebound. */
+static const struct {
+    akl_cfun_t           bi_fun;
+    int                  bi_argc;
+    akl_ir_instruction_t bi_op;
+} akl_builtin_instrs[] = {
+    { AKL_CAT(AKL_CFUN_PREFIX, plus),  2, AKL_IR_ADD },
+    { AKL_CAT(AKL_CFUN_PREFIX, minus), 2, AKL_IR_SUB },
+    { AKL_CAT(AKL_CFUN_PREFIX, mul),   2, AKL_IR_MUL },
+    { AKL_CAT(AKL_CFUN_PREFIX, ddiv),  2, AKL_IR_DIV },
+    { AKL_CAT(AKL_CFUN_PREFIX, lt),    2, AKL_IR_LT  },
+    { AKL_CAT(AKL_CFUN_PREFIX, gt),    2, AKL_IR_GT  },
+    { AKL_CAT(AKL_CFUN_PREFIX, eq),    2, AKL_IR_EQ  },
+    { AKL_CAT(AKL_CFUN_PREFIX, inc),   1, AKL_IR_INC },
+    { AKL_CAT(AKL_CFUN_PREFIX, dec),   1, AKL_IR_DEC },
+    { NULL, 0, AKL_IR_NOP }
+};
+
+akl_ir_instruction_t
+akl_builtin_instruction(struct akl_function *fn, int argc)
+{
+    int i;
+    if (fn == NULL || fn->fn_type != AKL_FUNC_CFUN)
+        return AKL_IR_NOP;
+
+    for (i = 0; akl_builtin_instrs[i].bi_fun != NULL; i++) {
+        if (akl_builtin_instrs[i].bi_fun == fn->fn_body.cfun
+            && akl_builtin_instrs[i].bi_argc == argc)
+            return akl_builtin_instrs[i].bi_op;
+    }
+    return AKL_IR_NOP;
+}
+
 AKL_DECLARE_FUNS(akl_basic_funs) {
-    AKL_FUN(inc,         "++", "Increment a number by one"),
-    AKL_FUN(dec,         "--", "Decrement a number by one"),
-    AKL_FUN(plus,        "+", "Arithmetic addition"),
-    AKL_FUN(minus,       "-", "Arithmetic substraction"),
-    AKL_FUN(mul,         "*", "Arithmetic product"),
-    AKL_FUN(ddiv,        "/", "Arithmetic division"),
-    AKL_FUN(idiv,        "div", "Integer division"),
-    AKL_FUN(mod,         "mod", "Integeral modulus"),
-    AKL_FUN(mod,         "%", "Integeral modulus"),
-    AKL_FUN(neq,         "!=", "Compare to values for inequality"),
-    AKL_FUN(eq,          "=", "Compare to values for equality"),
-    AKL_FUN(gt,          ">", "Greater compare function"),
-    AKL_FUN(lt,          "<", "Lesser than"),
-    AKL_FUN(gteq,        ">=", "Greater than or equal"),
-    AKL_FUN(lteq,        "<=", "Less or equal than"),
-    AKL_FUN(not,         "not", "Logical not"),
-    AKL_FUN(and,         "and", "Logical and"),
-    AKL_FUN(or,          "or", "Logical or"),
-    AKL_FUN(iszero,      "zero?", "Gives true if the parameter is zero, nil otherwise"),
-    AKL_FUN(isnil,       "nil?", "Gives true if the parameter is nil"),
-    AKL_FUN(isnumber,    "number?", "Gives true if the parameter is a number"),
-    AKL_FUN(isstring,    "string?", "Gives true if the parameter is a string"),
-    AKL_FUN(islist,      "list?", "Gives true if the parameter is a list"),
-    AKL_FUN(issymbol,    "symbol?", "Gives true if the parameter is a symbol"),
-    AKL_FUN(tonumber,    "number", "Converts values to a floating point number"),
-    AKL_FUN(toint,       "int", "Converts values to an integer number"),
+    AKL_PURE_FUN(inc,         "++", "Increment a number by one"),
+    AKL_PURE_FUN(dec,         "--", "Decrement a number by one"),
+    AKL_PURE_FUN(plus,        "+", "Arithmetic addition"),
+    AKL_PURE_FUN(minus,       "-", "Arithmetic substraction"),
+    AKL_PURE_FUN(mul,         "*", "Arithmetic product"),
+    AKL_PURE_FUN(ddiv,        "/", "Arithmetic division"),
+    AKL_PURE_FUN(idiv,        "div", "Integer division"),
+    AKL_PURE_FUN(mod,         "mod", "Integeral modulus"),
+    AKL_PURE_FUN(mod,         "%", "Integeral modulus"),
+    AKL_PURE_FUN(neq,         "!=", "Compare to values for inequality"),
+    AKL_PURE_FUN(eq,          "=", "Compare to values for equality"),
+    AKL_PURE_FUN(gt,          ">", "Greater compare function"),
+    AKL_PURE_FUN(lt,          "<", "Lesser than"),
+    AKL_PURE_FUN(gteq,        ">=", "Greater than or equal"),
+    AKL_PURE_FUN(lteq,        "<=", "Less or equal than"),
+    AKL_PURE_FUN(not,         "not", "Logical not"),
+    AKL_PURE_FUN(iszero,      "zero?", "Gives true if the parameter is zero, nil otherwise"),
+    AKL_PURE_FUN(isnil,       "nil?", "Gives true if the parameter is nil"),
+    AKL_PURE_FUN(isnumber,    "number?", "Gives true if the parameter is a number"),
+    AKL_PURE_FUN(isstring,    "string?", "Gives true if the parameter is a string"),
+    AKL_PURE_FUN(islist,      "list?", "Gives true if the parameter is a list"),
+    AKL_PURE_FUN(issymbol,    "symbol?", "Gives true if the parameter is a symbol"),
+    AKL_PURE_FUN(tonumber,    "number", "Converts values to a floating point number"),
+    AKL_PURE_FUN(toint,       "int", "Converts values to an integer number"),
     AKL_FUN(tostr,       "string", "Converts values to a string"),
     AKL_FUN(list,        "list", "Create a list from the given arguments"),
-    AKL_FUN(length,      "length", "Get the length of a string or the element count for a list"),
+    AKL_PURE_FUN(length,      "length", "Get the length of a string or the element count for a list"),
     AKL_FUN(ls_index,    "index", "Index a list or a string"),
     AKL_FUN(ls_head ,    "head", "Get the first element of a list or the first character of a string"),
     AKL_FUN(ls_head ,    "first", "Get the first element of a list or the first character of a string"),
@@ -2204,6 +2268,7 @@ AKL_DECLARE_FUNS(akl_debug_funs) {
     AKL_FUN(about,        "about", "Informations about the interpreter"),
     AKL_FUN(dump_vars, "dump-vars", "Display all global variables (with symbol pointers"),
     AKL_FUN(print_symbol_ptr,  "print-symbol-ptr", "Display the symbol's internal pointer"),
+    AKL_FUN(ic_stats,  "ic-stats", "Display the hit and miss counts of the call inline caches"),
     AKL_END_FUNS()
 };
 
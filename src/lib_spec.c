@@ -26,14 +26,31 @@
  * These functions are special forms. They build their own internal
  * representation by parsing the tokens.
 */
+
+/* Compile the next expression, which must leave its value on
+   the stack (a lambda is made to a function value) */
+static void
+compile_value(struct akl_context *ctx)
+{
+    struct akl_function *fn;
+    akl_compile_next(ctx, &fn);
+    if (fn)
+        akl_build_function(ctx, fn);
+}
+
 AKL_DEFINE_SFUN(when, ctx)
 {
     int loff = 0;
-    struct akl_list *label = akl_new_labels(ctx, &loff, 1);
+    struct akl_list *label = akl_new_labels(ctx, &loff, 2);
     akl_compile_next(ctx, NULL);
     akl_build_jump(ctx, AKL_JMP_FALSE, label, loff+0);
-    akl_compile_next(ctx, NULL);
+    compile_value(ctx);
+    akl_build_jump(ctx, AKL_JMP, label, loff+1);
+    /* .L0: The value of a false when is nil */
     akl_build_label(ctx, label, loff+0);
+    akl_build_push(ctx, AKL_NIL);
+    /* .L1: */
+    akl_build_label(ctx, label, loff+1);
     return NULL;
 }
 
@@ -41,8 +58,10 @@ AKL_DEFINE_SFUN(set, ctx)
 {
     assert(ctx && ctx->cx_state && ctx->cx_dev);
     struct akl_io_device *dev = ctx->cx_dev;
+    struct akl_variable *var;
     struct akl_symbol *sym;
     struct akl_function *fn;
+    int slot = -1;
     akl_token_t tok = akl_lex(dev);
     if (tok != tATOM) {
         akl_raise_error(ctx, AKL_ERROR, "Unexpected token, (need a valid atom for set!)");
@@ -51,35 +70,405 @@ AKL_DEFINE_SFUN(set, ctx)
     sym = akl_lex_get_symbol(dev);
     akl_compile_next(ctx, &fn);
     if (fn) {
-        akl_build_push(ctx, akl_new_function_value(ctx->cx_state, fn));
+        akl_build_function(ctx, fn);
+    }
+    if (ctx->cx_comp_func != NULL)
+        slot = akl_local_finder(&ctx->cx_comp_func->fn_body.ufun, sym);
+    if (slot != -1) {
+        /* Like set, it gives back the value */
+        akl_build_local_set(ctx, slot, TRUE);
+        return NULL;
+    }
+    if (ctx->cx_comp_func != NULL && akl_outer_finder(ctx->cx_comp_func, sym)) {
+        akl_raise_error(ctx, AKL_ERROR, "'%s' is captured by the lambda, "
+                        "it cannot be set.", sym->sb_name);
+        return NULL;
+    }
+    var = akl_get_global_var(ctx->cx_state, sym);
+    if (var && var->vr_is_const) {
+        akl_raise_error(ctx, AKL_ERROR, "'%s' is a constant, it cannot be set."
+                        , sym->sb_name);
+        return NULL;
     }
     akl_build_set(ctx, sym);
     return NULL;
 }
 
+/* Like set!, but the value must be a constant expression (a literal
+   or a folded call), which is bound at compile time. The later
+   references of the variable are replaced by the value itself.
+   Since the binding does not depend on the control flow, it is only
+   allowed at the top level, and a constant cannot get other value. */
+AKL_DEFINE_SFUN(set_const, ctx)
+{
+    assert(ctx && ctx->cx_state && ctx->cx_dev);
+    struct akl_io_device *dev = ctx->cx_dev;
+    struct akl_ir_instruction *in;
+    struct akl_variable *var;
+    struct akl_symbol *sym;
+    struct akl_function *fn;
+    unsigned int first;
+    akl_token_t tok = akl_lex(dev);
+    if (tok != tATOM) {
+        akl_raise_error(ctx, AKL_ERROR, "Unexpected token, (need a valid atom for set-const!)");
+        return NULL;
+    }
+    sym = akl_lex_get_symbol(dev);
+    first = akl_vector_count(ctx->cx_ir);
+    akl_compile_next(ctx, &fn);
+    if (fn) {
+        akl_build_function(ctx, fn);
+    }
+    if (!ctx->cx_parent->cx_is_toplevel) {
+        akl_raise_error(ctx, AKL_ERROR, "set-const! is only allowed "
+                        "at the top level (constant '%s').", sym->sb_name);
+        return NULL;
+    }
+
+    in = (struct akl_ir_instruction *)akl_vector_at(ctx->cx_ir, first);
+    var = akl_get_global_var(ctx->cx_state, sym);
+    if (akl_vector_count(ctx->cx_ir) != first + 1 || in->in_op != AKL_IR_PUSH) {
+        if (var && var->vr_is_const) {
+            akl_raise_error(ctx, AKL_ERROR, "'%s' is a constant, it cannot be set."
+                            , sym->sb_name);
+            return NULL;
+        }
+        akl_raise_error(ctx, AKL_WARNING, "The value of the constant '%s' "
+                        "is not a constant expression, using as a variable.", sym->sb_name);
+    } else if (var && var->vr_is_const
+               && akl_compare_values(var->vr_value, in->in_arg[0].value) != 0) {
+        akl_raise_error(ctx, AKL_ERROR, "'%s' is a constant, it cannot be "
+                        "bound to an other value.", sym->sb_name);
+        return NULL;
+    } else {
+        var = akl_set_global_var(ctx->cx_state, sym, NULL, FALSE, in->in_arg[0].value);
+        var->vr_is_const = TRUE;
+        if (!AKL_IS_IMMEDIATE(var->vr_value))
+            AKL_GC_SET_STATIC(var->vr_value);
+    }
+    akl_build_set(ctx, sym);
+    return NULL;
+}
+
+/* Compile the bindings ((name value) ...) and the body of a let form.
+   The variables get slots in the frame of the compiled function. With
+   'sequential' (let*), every variable can be used in the next values. */
+static void
+compile_let(struct akl_context *ctx, const char *form, bool_t sequential)
+{
+    struct akl_state *s = ctx->cx_state;
+    struct akl_io_device *dev = ctx->cx_dev;
+    struct akl_lisp_fun *uf;
+    struct akl_vector names;
+    struct akl_symbol *sym, **np;
+    struct akl_function *fn;
+    unsigned int scope, i;
+    /* The body is in tail position, if the let is */
+    bool_t is_tail = ctx->cx_parent->cx_is_tail;
+    akl_token_t tok;
+
+    if (ctx->cx_comp_func == NULL) {
+        akl_raise_error(ctx, AKL_ERROR, "%s: No function to hold the variables", form);
+        return;
+    }
+    uf = &ctx->cx_comp_func->fn_body.ufun;
+    scope = akl_vector_count(&uf->uf_locals);
+
+    tok = akl_lex(dev);
+    if (tok != tLBRACE && tok != tNIL) {
+        akl_raise_error(ctx, AKL_ERROR, "%s: Expected a list of bindings", form);
+        return;
+    }
+
+    akl_init_vector(s, &names, 4, sizeof(struct akl_symbol *));
+    while (tok == tLBRACE && (tok = akl_lex(dev)) != tRBRACE) {
+        if (tok != tLBRACE || akl_lex(dev) != tATOM) {
+            akl_raise_error(ctx, AKL_ERROR, "%s: A binding must be a (name value) list", form);
+            break;
+        }
+        sym = akl_lex_get_symbol(dev);
+        akl_compile_next(ctx, &fn);
+        if (fn) {
+            akl_build_function(ctx, fn);
+        }
+        if (akl_lex(dev) != tRBRACE) {
+            akl_raise_error(ctx, AKL_ERROR, "%s: The binding of '%s' must have "
+                            "exactly one value", form, sym->sb_name);
+            break;
+        }
+        if (sequential)
+            akl_build_local_set(ctx, akl_new_local(ctx, sym), FALSE);
+        else
+            akl_vector_push(&names, &sym);
+    }
+
+    /* The values of let are on the stack, the last one on the top */
+    if (!sequential && akl_vector_count(&names) > 0) {
+        np = (struct akl_symbol **)akl_vector_first(&names);
+        for (i = 0; i < akl_vector_count(&names); i++)
+            akl_new_local(ctx, np[i]);
+        for (i = akl_vector_count(&names); i > 0; i--)
+            akl_build_local_set(ctx, scope + i - 1, FALSE);
+    }
+    akl_vector_destroy(s, &names);
+
+    ctx->cx_is_tail = is_tail;
+    akl_compile_next(ctx, &fn);
+    ctx->cx_is_tail = FALSE;
+    if (fn) {
+        akl_build_function(ctx, fn);
+    }
+    /* End of the scope, the slots can be used again */
+    akl_vector_truncate_by(&uf->uf_locals, akl_vector_count(&uf->uf_locals) - scope);
+}
+
+AKL_DEFINE_SFUN(let, ctx)
+{
+    compile_let(ctx, "let", FALSE);
+    return NULL;
+}
+
+AKL_DEFINE_SFUN(let_seq, ctx)
+{
+    compile_let(ctx, "let*", TRUE);
+    return NULL;
+}
+
+/* Compile the arguments of and/or, with a jump after every argument
+   (except the last one), if the result is already known. The result
+   is the value of the last evaluated argument (or nil for a false and). */
+static void
+compile_logical(struct akl_context *ctx, bool_t is_and)
+{
+    struct akl_io_device *dev = ctx->cx_dev;
+    struct akl_lisp_fun *uf;
+    unsigned int scope;
+    unsigned int tmp = 0, n = 0;
+    int loff = 0;
+    struct akl_list *labels;
+    akl_token_t tok;
+
+    if (ctx->cx_comp_func == NULL) {
+        akl_raise_error(ctx, AKL_ERROR, "%s: No function to hold the variables"
+                        , is_and ? "and" : "or");
+        return;
+    }
+    uf = &ctx->cx_comp_func->fn_body.ufun;
+    scope = akl_vector_count(&uf->uf_locals);
+    /* .L0: End, .L1: The result is known */
+    labels = akl_new_labels(ctx, &loff, 2);
+
+    while ((tok = akl_lex(dev)) != tRBRACE && tok != tEOF) {
+        /* The previous argument was not the last one */
+        if (n > 0) {
+            if (is_and) {
+                akl_build_jump(ctx, AKL_JMP_FALSE, labels, loff+1);
+            } else {
+                /* The jump takes the value, the result is kept in a slot */
+                if (n == 1)
+                    tmp = akl_new_local(ctx, NULL);
+                akl_build_local_set(ctx, tmp, TRUE);
+                akl_build_jump(ctx, AKL_JMP_TRUE, labels, loff+1);
+            }
+        }
+        akl_lex_putback(dev, tok);
+        compile_value(ctx);
+        n++;
+    }
+    /* akl_compile_list() needs the closing brace */
+    akl_lex_putback(dev, tok);
+
+    if (n == 0) {
+        akl_build_push(ctx, is_and ? AKL_TRUE : AKL_NIL);
+    } else if (n > 1) {
+        akl_build_jump(ctx, AKL_JMP, labels, loff+0);
+        /* .L1: */
+        akl_build_label(ctx, labels, loff+1);
+        if (is_and)
+            akl_build_push(ctx, AKL_NIL);
+        else
+            akl_build_local_get(ctx, tmp);
+        /* .L0: */
+        akl_build_label(ctx, labels, loff+0);
+    }
+    akl_vector_truncate_by(&uf->uf_locals, akl_vector_count(&uf->uf_locals) - scope);
+}
+
+AKL_DEFINE_SFUN(and, ctx)
+{
+    compile_logical(ctx, TRUE);
+    return NULL;
+}
+
+AKL_DEFINE_SFUN(or, ctx)
+{
+    compile_logical(ctx, FALSE);
+    return NULL;
+}
+
 AKL_DEFINE_SFUN(sif, ctx)
 {
     /* Allocate the branch */
     int loff = 0;
     struct akl_list *labels = akl_new_labels(ctx, &loff, 2);
+    /* Both branches are in tail position, if the if is */
+    bool_t is_tail = ctx->cx_parent->cx_is_tail;
 
     /* Condition:*/
     akl_compile_next(ctx, NULL);
     akl_build_jump(ctx, AKL_JMP_FALSE, labels, loff+1);
 
     /* True branch: */
-    akl_compile_next(ctx, NULL);
+    ctx->cx_is_tail = is_tail;
+    compile_value(ctx);
+    ctx->cx_is_tail = FALSE;
     akl_build_jump(ctx, AKL_JMP, labels, loff+0);
 
     /* .L1: False branch: */
     akl_build_label(ctx, labels, loff+1);
-    akl_compile_next(ctx, NULL);
+    ctx->cx_is_tail = is_tail;
+    compile_value(ctx);
+    ctx->cx_is_tail = FALSE;
 
     /* .L0: Continue... */
     akl_build_label(ctx, labels, loff+0);
     return NULL;
 }
 
+/* (cond (test value) ...): The tests are tried one after the other,
+   the value of the first true one is given (or nil). */
+AKL_DEFINE_SFUN(cond, ctx)
+{
+    struct akl_io_device *dev = ctx->cx_dev;
+    bool_t is_tail = ctx->cx_parent->cx_is_tail;
+    int lend = 0, lnext = 0;
+    struct akl_list *labels = akl_new_labels(ctx, &lend, 1);
+    akl_token_t tok;
+
+    while ((tok = akl_lex(dev)) == tLBRACE) {
+        labels = akl_new_labels(ctx, &lnext, 1);
+        compile_value(ctx);
+        akl_build_jump(ctx, AKL_JMP_FALSE, labels, lnext);
+
+        ctx->cx_is_tail = is_tail;
+        compile_value(ctx);
+        ctx->cx_is_tail = FALSE;
+        akl_build_jump(ctx, AKL_JMP, labels, lend);
+        if (akl_lex(dev) != tRBRACE) {
+            akl_raise_error(ctx, AKL_ERROR, "cond: A clause must be a (test value) list");
+            return NULL;
+        }
+        akl_build_label(ctx, labels, lnext);
+    }
+    akl_lex_putback(dev, tok);
+    /* None of them was true */
+    akl_build_push(ctx, AKL_NIL);
+    akl_build_label(ctx, labels, lend);
+    return NULL;
+}
+
+/* Parse one key of a case clause. Gives FALSE on the default
+   key (t, else or otherwise) */
+static bool_t
+parse_case_key(struct akl_context *ctx, akl_token_t tok, struct akl_switch_entry *e)
+{
+    struct akl_io_device *dev = ctx->cx_dev;
+    double d;
+
+    e->se_sym = NULL;
+    e->se_num = 0;
+    if (tok == tQUOTE)
+        tok = akl_lex(dev);
+
+    switch (tok) {
+        case tNUMBER:
+        d = akl_lex_get_number(dev);
+        e->se_num = (long)d;
+        if ((double)e->se_num != d) {
+            akl_raise_error(ctx, AKL_ERROR, "case: The number keys must be integers");
+        }
+        return TRUE;
+
+        case tATOM:
+        e->se_sym = akl_lex_get_symbol(dev);
+        if (!strcasecmp(e->se_sym->sb_name, "else")
+            || !strcasecmp(e->se_sym->sb_name, "otherwise"))
+            return FALSE;
+        return TRUE;
+
+        case tTRUE:
+        return FALSE;
+
+        default:
+        akl_raise_error(ctx, AKL_ERROR, "case: The keys must be integer numbers or symbols");
+        return TRUE;
+    }
+}
+
+/* (case key (k value) ((k1 k2 ...) value) ... (else value)):
+   The keys are constants (not evaluated), the value is selected
+   by a jump table (SWITCH). */
+AKL_DEFINE_SFUN(scase, ctx)
+{
+    struct akl_state *s = ctx->cx_state;
+    struct akl_io_device *dev = ctx->cx_dev;
+    bool_t is_tail = ctx->cx_parent->cx_is_tail;
+    struct akl_label *def = NULL;
+    struct akl_switch_entry e;
+    struct akl_vector keys;
+    unsigned int sw;
+    int lend = 0, lbranch = 0;
+    struct akl_list *labels;
+    akl_token_t tok;
+
+    compile_value(ctx);
+    sw = akl_build_switch(ctx);
+    labels = akl_new_labels(ctx, &lend, 1);
+    akl_init_vector(s, &keys, 8, sizeof(struct akl_switch_entry));
+
+    while ((tok = akl_lex(dev)) == tLBRACE) {
+        labels = akl_new_labels(ctx, &lbranch, 1);
+        e.se_label = (struct akl_label *)akl_list_index(labels, lbranch);
+        tok = akl_lex(dev);
+        if (tok == tLBRACE) {
+            /* List of keys */
+            while ((tok = akl_lex(dev)) != tRBRACE && tok != tEOF) {
+                if (parse_case_key(ctx, tok, &e))
+                    akl_vector_push(&keys, &e);
+                else if (def == NULL)
+                    def = e.se_label;
+            }
+        } else if (parse_case_key(ctx, tok, &e)) {
+            akl_vector_push(&keys, &e);
+        } else if (def == NULL) {
+            def = e.se_label;
+        }
+
+        akl_build_label(ctx, labels, lbranch);
+        ctx->cx_is_tail = is_tail;
+        compile_value(ctx);
+        ctx->cx_is_tail = FALSE;
+        akl_build_jump(ctx, AKL_JMP, labels, lend);
+        if (akl_lex(dev) != tRBRACE) {
+            akl_raise_error(ctx, AKL_ERROR, "case: A clause must be a (key value) list");
+            break;
+        }
+    }
+    if (tok != tLBRACE)
+        akl_lex_putback(dev, tok);
+
+    /* Without a default clause, the value is nil */
+    if (def == NULL) {
+        labels = akl_new_labels(ctx, &lbranch, 1);
+        def = (struct akl_label *)akl_list_index(labels, lbranch);
+        akl_build_label(ctx, labels, lbranch);
+        akl_build_push(ctx, AKL_NIL);
+    }
+    akl_build_label(ctx, labels, lend);
+    akl_finish_switch(ctx, sw, &keys, def);
+    return NULL;
+}
+
 AKL_DEFINE_SFUN(swhile, ctx)
 {
     int loff = 0;
@@ -88,13 +477,154 @@ AKL_DEFINE_SFUN(swhile, ctx)
     akl_build_label(ctx, labels, loff+0);
     akl_compile_next(ctx, NULL);
     akl_build_jump(ctx, AKL_JMP_FALSE, labels, loff+1);
-    /* the loop itself */
-    akl_compile_next(ctx, NULL);
+    /* the loop itself, its value is not needed */
+    compile_value(ctx);
+    akl_build_pop(ctx);
     /* Jump back to the condition: (with an unconditional) */
     akl_build_jump(ctx, AKL_JMP, labels, loff+0);
 
     /* .L1: Getting out of the loop... */
     akl_build_label(ctx, labels, loff+1);
+    akl_build_push(ctx, AKL_NIL);
+    return NULL;
+}
+
+/* Call a builtin by its name, it gets its own instruction (like '<'),
+   if the name is still bound to the builtin */
+static void
+build_builtin_call(struct akl_context *ctx, char *name, int argc)
+{
+    struct akl_state *s = ctx->cx_state;
+    struct akl_symbol *sym = akl_get_or_create_symbol(s, name);
+    struct akl_variable *var = akl_get_global_var(s, sym);
+    struct akl_function *fn = NULL;
+    if (var != NULL && AKL_CHECK_TYPE(var->vr_value, AKL_VT_FUNCTION))
+        fn = var->vr_value->va_value.func;
+    akl_build_call(ctx, sym, fn, argc);
+}
+
+/* Parse the head of a loop: '(name value)', the value is on the
+   stack after it. Gives the name of the loop variable. */
+static struct akl_symbol *
+compile_loop_head(struct akl_context *ctx, const char *form)
+{
+    struct akl_io_device *dev = ctx->cx_dev;
+    struct akl_symbol *sym;
+
+    if (ctx->cx_comp_func == NULL) {
+        akl_raise_error(ctx, AKL_ERROR, "%s: No function to hold the variables", form);
+        return NULL;
+    }
+    if (akl_lex(dev) != tLBRACE || akl_lex(dev) != tATOM) {
+        akl_raise_error(ctx, AKL_ERROR, "%s: Expected a (variable value) list", form);
+        return NULL;
+    }
+    sym = akl_lex_get_symbol(dev);
+    compile_value(ctx);
+    if (akl_lex(dev) != tRBRACE) {
+        akl_raise_error(ctx, AKL_ERROR, "%s: The head of the loop must have "
+                        "exactly one value", form);
+        return NULL;
+    }
+    return sym;
+}
+
+/* The rest of the expressions are the loop body, their values are dropped */
+static void
+compile_loop_body(struct akl_context *ctx)
+{
+    struct akl_io_device *dev = ctx->cx_dev;
+    akl_token_t tok;
+
+    while ((tok = akl_lex(dev)) != tRBRACE && tok != tEOF) {
+        akl_lex_putback(dev, tok);
+        compile_value(ctx);
+        akl_build_pop(ctx);
+    }
+    /* akl_compile_list() needs the closing brace */
+    akl_lex_putback(dev, tok);
+}
+
+/* (dotimes (i n) body...): Evaluate the body with i = 0 .. n-1.
+   The counter and the limit are in local slots, so the loop
+   is only jumps and instructions, without any calls. */
+AKL_DEFINE_SFUN(dotimes, ctx)
+{
+    struct akl_lisp_fun *uf;
+    struct akl_symbol *sym;
+    unsigned int scope, limit, var;
+    int loff = 0;
+    struct akl_list *labels;
+
+    sym = compile_loop_head(ctx, "dotimes");
+    if (sym == NULL)
+        return NULL;
+    uf = &ctx->cx_comp_func->fn_body.ufun;
+    scope = akl_vector_count(&uf->uf_locals);
+    labels = akl_new_labels(ctx, &loff, 2);
+
+    /* The limit is checked only once (i < n is true for
+       every non-number n) */
+    akl_build_number_check(ctx);
+    limit = akl_new_local(ctx, NULL);
+    akl_build_local_set(ctx, limit, FALSE);
+    akl_build_push(ctx, AKL_NUMBER(ctx, 0));
+    var = akl_new_local(ctx, sym);
+    akl_build_local_set(ctx, var, FALSE);
+
+    /* .L0: (< i n) */
+    akl_build_label(ctx, labels, loff+0);
+    akl_build_local_get(ctx, var);
+    akl_build_local_get(ctx, limit);
+    build_builtin_call(ctx, "<", 2);
+    akl_build_jump(ctx, AKL_JMP_FALSE, labels, loff+1);
+    compile_loop_body(ctx);
+    /* (set! i (++ i)) */
+    akl_build_local_get(ctx, var);
+    build_builtin_call(ctx, "++", 1);
+    akl_build_local_set(ctx, var, FALSE);
+    akl_build_jump(ctx, AKL_JMP, labels, loff+0);
+
+    /* .L1: */
+    akl_build_label(ctx, labels, loff+1);
+    akl_build_push(ctx, AKL_NIL);
+    akl_vector_truncate_by(&uf->uf_locals, akl_vector_count(&uf->uf_locals) - scope);
+    return NULL;
+}
+
+/* (dolist (x list) body...): Evaluate the body for every element of
+   the list. The iterator walks the list entries directly. */
+AKL_DEFINE_SFUN(dolist, ctx)
+{
+    struct akl_lisp_fun *uf;
+    struct akl_symbol *sym;
+    unsigned int scope, iter, var;
+    int loff = 0;
+    struct akl_list *labels;
+
+    sym = compile_loop_head(ctx, "dolist");
+    if (sym == NULL)
+        return NULL;
+    uf = &ctx->cx_comp_func->fn_body.ufun;
+    scope = akl_vector_count(&uf->uf_locals);
+    labels = akl_new_labels(ctx, &loff, 2);
+
+    akl_build_list_iter(ctx);
+    iter = akl_new_local(ctx, NULL);
+    akl_build_local_set(ctx, iter, FALSE);
+    var = akl_new_local(ctx, sym);
+
+    /* .L0: The next element, or the end */
+    akl_build_label(ctx, labels, loff+0);
+    akl_build_list_next(ctx, iter, labels, loff+1);
+    akl_build_local_set(ctx, var, FALSE);
+    compile_loop_body(ctx);
+    akl_build_jump(ctx, AKL_JMP, labels, loff+0);
+
+    /* .L1: */
+    akl_build_label(ctx, labels, loff+1);
+    akl_build_push(ctx, AKL_NIL);
+    akl_vector_truncate_by(&uf->uf_locals, akl_vector_count(&uf->uf_locals) - scope);
     return NULL;
 }
 
@@ -139,14 +669,15 @@ AKL_DEFINE_SFUN(defun, ctx)
     akl_token_t tok;
     struct akl_function *func = akl_new_function(ctx->cx_state);
     struct akl_value *fval = akl_new_function_value(ctx->cx_state, func);
-    struct akl_list *oir = ctx->cx_ir;
+    struct akl_vector *oir = ctx->cx_ir;
     struct akl_symbol *fsym;
     char *docstring = NULL;
+    /* Only the top level functions are compiled lazily */
+    bool_t is_toplevel = (ctx->cx_comp_func == ctx->cx_fn_main);
 
     func->fn_type = AKL_FUNC_USER;
     ufun = &func->fn_body.ufun;
-    akl_init_list(&ufun->uf_body);
-    akl_init_list(&ufun->uf_labels);
+    akl_init_lisp_fun(ctx->cx_state, ufun);
 
     if (akl_lex(ctx->cx_dev) == tATOM) {
         fsym = akl_lex_get_symbol(ctx->cx_dev);
@@ -164,14 +695,24 @@ AKL_DEFINE_SFUN(defun, ctx)
     tok = akl_lex(ctx->cx_dev);
     if (tok == tSTRING) {
         docstring = akl_lex_get_string(ctx->cx_dev);
-        tok = akl_lex(ctx->cx_dev);
     } else {
         akl_lex_putback(ctx->cx_dev, tok);
     }
     akl_set_global_var(ctx->cx_state, fsym, docstring, FALSE, fval);
 
+    /* Just remember the place of the body, it will be
+       compiled at the first call (see lazy-compile) */
+    if (is_toplevel && akl_compile_defer(ctx, func)) {
+        ctx->cx_ir = oir;
+        akl_build_push(ctx, akl_new_sym_value(ctx->cx_state, fsym));
+        return func;
+    }
+
     //tok = akl_lex(ctx->cx_dev);
-    akl_compile_next(ctx, NULL);
+    ctx->cx_is_tail = TRUE;
+    compile_value(ctx);
+    ctx->cx_is_tail = FALSE;
+    akl_build_ret(ctx);
 #if 0
     if (tok == tLBRACE) {
         akl_compile_list(ctx);
@@ -180,6 +721,7 @@ AKL_DEFINE_SFUN(defun, ctx)
         akl_compile_list(ctx);
     }
 #endif
+    akl_ir_finalize(ctx);
 
     /* Build needs the old IR */
     ctx->cx_ir = oir;
@@ -196,9 +738,10 @@ AKL_DEFINE_SFUN(lambda, ctx)
 
     func->fn_type = AKL_FUNC_USER;
     ufun = &func->fn_body.ufun;
-    akl_init_list(&ufun->uf_body);
-    akl_init_list(&ufun->uf_labels);
+    akl_init_lisp_fun(ctx->cx_state, ufun);
 
+    /* The variables of the enclosing function can be captured */
+    ufun->uf_outer = ctx->cx_comp_func;
     ctx->cx_comp_func = func;
     akl_parse_params(ctx, NULL, &ufun->uf_args);
     ctx->cx_ir = &ufun->uf_body;
@@ -210,7 +753,11 @@ AKL_DEFINE_SFUN(lambda, ctx)
     } else {
         akl_lex_putback(ctx->cx_dev, tok);
     }
-    akl_compile_next(ctx, NULL);
+    ctx->cx_is_tail = TRUE;
+    compile_value(ctx);
+    ctx->cx_is_tail = FALSE;
+    akl_build_ret(ctx);
+    akl_ir_finalize(ctx);
     return func;
 }
 
@@ -220,8 +767,18 @@ AKL_DECLARE_FUNS(akl_spec_forms) {
     AKL_SFUN(lambda, "->", "Define a lambda function"),
     AKL_SFUN(when, "when", "Conditionally evaluate an expression"),
     AKL_SFUN(swhile, "while", "Conditional loop expression"),
+    AKL_SFUN(dotimes, "dotimes", "Loop with a counter from zero"),
+    AKL_SFUN(dolist, "dolist", "Loop over the elements of a list"),
+    AKL_SFUN(dolist, "for-each", "Loop over the elements of a list"),
+    AKL_SFUN(cond, "cond", "Give the value of the first clause with a true test"),
+    AKL_SFUN(scase, "case", "Select a value by constant keys (with a jump table)"),
     AKL_SFUN(defun, "defun!", "Define a new function"),
     AKL_SFUN(set, "set!", "Define a new global variable"),
+    AKL_SFUN(set_const, "set-const!", "Define a new global constant"),
+    AKL_SFUN(and, "and", "Logical and (gives the last value, or nil)"),
+    AKL_SFUN(or, "or", "Logical or (gives the first true value, or nil)"),
+    AKL_SFUN(let, "let", "Evaluate an expression with local variables"),
+    AKL_SFUN(let_seq, "let*", "Like let, but the variables are bound sequentially"),
     AKL_END_FUNS()
 };
 
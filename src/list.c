@@ -32,10 +32,12 @@ struct akl_list_entry
     if (list->li_head == NULL) {
         list->li_head = ent;
     } else {
+        AKL_GC_LIST_BARRIER(s, list->li_last, ent);
         list->li_last->le_next = ent;
         ent->le_prev = list->li_last;
     }
 
+    AKL_GC_LIST_BARRIER(s, list, ent);
     list->li_last = ent;
     list->li_count++;
     list->is_nil = FALSE;
@@ -59,9 +61,11 @@ akl_list_insert_head(struct akl_state *s, struct akl_list *list, void *data)
     if (list->li_head == NULL) {
         list->li_last = ent;
     } else {
+        AKL_GC_LIST_BARRIER(s, list->li_head, ent);
         list->li_head->le_prev = ent;
         ent->le_next = list->li_head; 
     }
+    AKL_GC_LIST_BARRIER(s, list, ent);
     list->li_head = ent;
     list->li_count++;
     list->is_nil = FALSE;
@@ -115,7 +119,7 @@ struct akl_value *akl_duplicate_value(struct akl_state *in, struct akl_value *ov
     if (oval == NULL)
         return NULL;
 
-    switch (oval->va_type) {
+    switch (AKL_TYPE(oval)) {
         case AKL_VT_LIST:
         return akl_new_list_value(in
                   , akl_list_duplicate(in, AKL_GET_LIST_VALUE(oval)));
@@ -363,7 +367,7 @@ void akl_print_value(struct akl_state *s, struct akl_value *val)
         return;
     }
 
-    switch (val->va_type) {
+    switch (AKL_TYPE(val)) {
         case AKL_VT_NUMBER:
         AKL_START_COLOR(s, AKL_YELLOW);
         printf("%g", AKL_GET_NUMBER_VALUE(val));
@@ -38,26 +38,23 @@ static struct akl_state state;
 #include <readline/history.h>
 
 /* Give back a possible completion of 'text', by traversing
- through the red black tree of all global symbols. */
+ through the table of all global symbols. */
 static char *
 akl_symbol_generator(const char *text, int st)
 {
-    static struct akl_symbol *sym = NULL;
+    static unsigned int it = 0;
     static size_t tlen = 0;
-    /* If this is the first run, initialize the symbol with
-      the first element of the red black tree. */
+    struct akl_symbol *sym;
+    /* If this is the first run, start from the
+      beginning of the symbol table. */
     if (!st) {
-        sym = RB_MIN(SYM_TREE, &state.ai_symbols);
+        it = 0;
         tlen = strlen(text);
-    } else {
-        sym = RB_NEXT(SYM_TREE, &state.ai_symbols, sym);
     }
 
-    while (sym != NULL) {
+    while ((sym = akl_next_symbol(&state, &it)) != NULL) {
         if (strncasecmp(sym->sb_name, text, tlen) == 0)
             return strdup(sym->sb_name);
-
-        sym = RB_NEXT(SYM_TREE, &state.ai_symbols, sym);
     }
     return NULL;
 }
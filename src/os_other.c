@@ -39,3 +39,14 @@ struct akl_module *akl_load_module_desc(struct akl_state *s, char *modpath)
 {
     return NULL;
 }
+
+/* No page allocation, the GC pools are just malloc()'d */
+void *akl_alloc_pages(struct akl_state *s, size_t size)
+{
+    return s->ai_mem_fn->mc_malloc_fn(size);
+}
+
+void akl_free_pages(struct akl_state *s, void *ptr, size_t size)
+{
+    s->ai_mem_fn->mc_free_fn(ptr);
+}
@@ -24,6 +24,8 @@
 #include <unistd.h>
 #include <dlfcn.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdint.h>
 #define __USE_GNU 1
 #include <signal.h>
 
@@ -226,6 +228,36 @@ void akl_module_free(struct akl_state *s, struct akl_module *mod)
     //akl_free(s, mod->am_path, strlen(mod->am_path));
 }
 
+/* The pages of the GC pools are mapped directly. The big pools are
+   aligned to their size, so they can be backed by huge pages. */
+void *akl_alloc_pages(struct akl_state *s, size_t size)
+{
+    char *p, *start;
+    size_t map = size;
+    if (size >= AKL_GC_HUGE_PAGE_BYTES)
+        map = 2*size;
+    p = mmap(NULL, map, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    if (map == size)
+        return p;
+
+    start = (char *)(((uintptr_t)p + size - 1) & ~(uintptr_t)(size - 1));
+    if (start != p)
+        munmap(p, start - p);
+    if (start + size != p + map)
+        munmap(start + size, (p + map) - (start + size));
+#ifdef MADV_HUGEPAGE
+    madvise(start, size, MADV_HUGEPAGE);
+#endif
+    return start;
+}
+
+void akl_free_pages(struct akl_state *s, void *ptr, size_t size)
+{
+    munmap(ptr, size);
+}
+
 /* Unfortunately, this must be a pointer */
 static struct akl_state *int_state;
 void interrupt_program(int sig)
@@ -25,3 +25,13 @@ void akl_free_module(struct akl_state *s, struct akl_module *mod)
     
     akl_free(s, mod->am_path);
 }
+
+void *akl_alloc_pages(struct akl_state *s, size_t size)
+{
+    return VirtualAlloc(NULL, size, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+}
+
+void akl_free_pages(struct akl_state *s, void *ptr, size_t size)
+{
+    VirtualFree(ptr, 0, MEM_RELEASE);
+}
@@ -57,7 +57,8 @@ akl_parse_token(struct akl_context *ctx, akl_token_t tok, bool_t is_quoted)
         break;
 
         case tNUMBER:
-        value = AKL_NUMBER(ctx, akl_lex_get_number(dev));
+        /* Literals are boxed, since they carry lexical information */
+        value = akl_new_boxed_number_value(s, akl_lex_get_number(dev));
         break;
 
         case tSTRING:
@@ -147,7 +148,14 @@ const char *akl_ir_instruction_set[] = {
   , "call" , "get"   , "set"
   , "br"   , "jmp"   , "jt"
   , "jn"   , "head"  , "tail"
-  , "ret"  , NULL
+  , "ret"  , "add"   , "sub"
+  , "mul"  , "div"   , "lt"
+  , "gt"   , "eq"    , "inc"
+  , "dec"  , "load2" , "tailcall"
+  , "local-get", "local-set", "capture-load"
+  , "closure", "switch", "pop"
+  , "list-iter", "list-next", "number-check"
+  , NULL
 };
 
 //#define AKL_ASSEMBLER
@@ -166,10 +174,10 @@ static void akl_asm_parse_label(struct akl_context *ctx)
     ufun = &fn->fn_body.ufun;
     if (label && label_name) {
         label->la_name = label_name;
-        label->la_ir = ctx->cx_ir;
-        label->la_branch = AKL_LIST_LAST(label->la_ir);
+        /* The label points to the next instruction */
+        label->la_branch = akl_vector_count(ctx->cx_ir);
     }
-    akl_vector_push(ufun->uf_labels, label);
+    akl_list_append(ctx->cx_state, &ufun->uf_labels, label);
     if (akl_asm_lex(ctx->cx_dev) != tASM_COLON)
         ; /* Error */
 }
@@ -197,30 +205,31 @@ label_finder(void *f, void *s)
     b = (struct akl_label *)s;
 
     assert(a && a->la_name && b && b->la_name);
-    return strcmp(a->la_name, a->la_name);
+    return strcmp(a->la_name, b->la_name);
 }
 
 struct akl_label *
 akl_get_or_create_label(struct akl_context *ctx, char *lname)
 {
-    unsigned int ind;
     struct akl_function *fn = ctx->cx_comp_func;
     struct akl_label fl, *label;
     struct akl_lisp_fun *ufun;
-    void *ptr;
+    struct akl_list_entry *ent;
     if (fn == NULL)
         return NULL;
 
     fl.la_name = lname;
 
     ufun = &fn->fn_body.ufun;
-    ptr = akl_vector_find(ufun->uf_labels, label_finder, (void *)&fl, &ind);
-    if (ptr == NULL) {
+    ent = akl_list_find(&ufun->uf_labels, label_finder, (void *)&fl, NULL);
+    if (ent == NULL) {
         label = akl_new_label(ctx);
+        akl_init_label(label, akl_list_count(&ufun->uf_labels));
         label->la_name = lname;
+        akl_list_append(ctx->cx_state, &ufun->uf_labels, label);
+        return label;
     }
-    label = akl_vector_at(ufun->uf_labels, ind);
-    return label;
+    return (struct akl_label *)ent->le_data;
 
 }
 
@@ -307,6 +316,7 @@ void akl_asm_parse_instr(struct akl_context *ctx)
 
         case AKL_IR_RET:
         akl_build_ret(ctx);
+        akl_ir_finalize(ctx);
         return; /* End of function */
     }
 }
@@ -321,7 +331,9 @@ void akl_asm_parse_func(struct akl_context *ctx)
     struct akl_function *fn = akl_new_function(s);
 
     fn->fn_type = AKL_FUNC_USER;
+    akl_init_lisp_fun(s, &fn->fn_body.ufun);
     ctx->cx_comp_func = fn;
+    ctx->cx_ir = &fn->fn_body.ufun.uf_body;
     do {
         tok = akl_asm_lex(dev);
         switch (tok) {
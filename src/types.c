@@ -60,14 +60,24 @@ void akl_init_state(struct akl_state *s, const struct akl_mem_callbacks *cbs)
     s->ai_interrupted = FALSE;
     AKL_SET_FEATURE(s, AKL_CFG_USE_COLORS);
     AKL_SET_FEATURE(s, AKL_CFG_USE_GC);
+    AKL_SET_FEATURE(s, AKL_CFG_GEN_GC);
+    AKL_SET_FEATURE(s, AKL_CFG_OPTIMIZE);
     akl_gc_init(s);
 
-    RB_INIT(&s->ai_symbols);
+    s->ai_symbols.st_size  = AKL_SYMTAB_DEFSIZE;
+    s->ai_symbols.st_count = 0;
+    s->ai_symbols.st_slots = (struct akl_symbol **)akl_calloc(s
+                              , AKL_SYMTAB_DEFSIZE, sizeof(struct akl_symbol *));
     RB_INIT(&s->ai_global_vars);
     s->ai_device = NULL;
     akl_init_list(&s->ai_modules);
     akl_init_vector(s, &s->ai_utypes, 5, sizeof(struct akl_module *));
-    akl_init_list(&s->ai_stack);
+    akl_init_vector(s, &s->ai_stack, AKL_STACK_DEFSIZE, sizeof(struct akl_value *));
+    s->ai_call_stack = (struct akl_context *)akl_calloc(s, AKL_CALL_STACK_SIZE
+                                               , sizeof(struct akl_context));
+    s->ai_call_depth = 0;
+    s->ai_ic_hits    = 0;
+    s->ai_ic_misses  = 0;
     s->ai_errors   = NULL;
     akl_init_context(&s->ai_context);
     akl_init_os(s);
@@ -119,30 +129,33 @@ void akl_init_context(struct akl_context *ctx)
     ctx->cx_ir        = NULL;
     ctx->cx_lex_info  = NULL;
     ctx->cx_parent    = NULL;
-    ctx->cx_frame     = NULL;
+    ctx->cx_frame.fr_bottom = 0;
+    ctx->cx_frame.fr_base   = 0;
+    ctx->cx_frame.fr_count  = 0;
+    ctx->cx_frame.fr_locals = 0;
     ctx->cx_stack     = NULL;
     ctx->cx_fn_main   = NULL;
     ctx->cx_frame_len = 0;
+    ctx->cx_ip        = 0;
+    ctx->cx_comp_func = NULL;
+    ctx->cx_is_tail   = FALSE;
+    ctx->cx_is_toplevel = FALSE;
 }
 
 void
 akl_init_frame(struct akl_context *ctx, int len)
 {
-    int fs = len;
-    struct akl_list_entry *it = akl_list_it_end(ctx->cx_stack);
+    struct akl_frame *fr = &ctx->cx_frame;
+    unsigned int sp = akl_vector_count(ctx->cx_stack);
 
-    ctx->cx_frame = akl_new_list(ctx->cx_state);
-    if (fs == -1) {
-        return;
-    }
+    if (len < 0 || (unsigned int)len > sp)
+        len = 0;
 
-    ctx->cx_frame->li_count = len;
+    /* The arguments are the last 'len' values of the stack */
+    fr->fr_bottom = fr->fr_base = sp - len;
+    fr->fr_count  = len;
+    fr->fr_locals = 0;
     ctx->cx_frame_len = len;
-    ctx->cx_frame->li_last = it;
-    while (--fs && akl_list_it_has_prev(it)) {
-        akl_list_it_prev(&it);
-    }
-    ctx->cx_frame->li_head = it;
 }
 
 struct akl_context *
@@ -154,17 +167,78 @@ akl_new_context(struct akl_state *s)
     return ctx;
 }
 
+/* FNV-1a hash of the lowercase name, since symbols are case insensitive */
+unsigned int
+akl_hash_name(const char *name)
+{
+    unsigned int h = 2166136261U;
+    while (*name) {
+        h ^= (unsigned char)tolower((unsigned char)*name++);
+        h *= 16777619U;
+    }
+    return h;
+}
+
+/* Find the slot of the given name (or the empty slot, where it should be) */
+static struct akl_symbol **
+find_symbol_slot(struct akl_symbol_table *st, const char *name, unsigned int h)
+{
+    unsigned int mask = st->st_size - 1;
+    unsigned int i = h & mask;
+    struct akl_symbol *sym;
+
+    while ((sym = st->st_slots[i]) != NULL) {
+        if (sym->sb_hash == h && strcasecmp(sym->sb_name, name) == 0)
+            break;
+        i = (i + 1) & mask;
+    }
+    return &st->st_slots[i];
+}
+
+static void
+grow_symbol_table(struct akl_state *s, struct akl_symbol_table *st)
+{
+    struct akl_symbol **oslots = st->st_slots;
+    unsigned int osize = st->st_size;
+    unsigned int i, j, mask;
+
+    st->st_size *= 2;
+    st->st_slots = (struct akl_symbol **)akl_calloc(s, st->st_size
+                                        , sizeof(struct akl_symbol *));
+    mask = st->st_size - 1;
+    for (i = 0; i < osize; i++) {
+        if (oslots[i] == NULL)
+            continue;
+        /* The names are different, just find an empty slot */
+        j = oslots[i]->sb_hash & mask;
+        while (st->st_slots[j] != NULL)
+            j = (j + 1) & mask;
+        st->st_slots[j] = oslots[i];
+    }
+    akl_free(s, oslots, osize * sizeof(struct akl_symbol *));
+}
+
 static struct akl_symbol *
 get_or_create_symbol(struct akl_state *s, char *name) 
 {
-    struct akl_symbol *sym = akl_get_symbol(s, name);
+    struct akl_symbol_table *st = &s->ai_symbols;
+    unsigned int h = akl_hash_name(name);
+    struct akl_symbol **slot = find_symbol_slot(st, name, h);
+    struct akl_symbol *sym = *slot;
 
     if (sym == NULL) {
+        /* Keep the load factor under 1/2 */
+        if ((st->st_count + 1) * 2 > st->st_size) {
+            grow_symbol_table(s, st);
+            slot = find_symbol_slot(st, name, h);
+        }
         sym = AKL_MALLOC(s, struct akl_symbol);
         if (sym) {
-            sym->sb_name    = name; /* SYM_TREE_RB_INSERT() needs this */
+            sym->sb_hash    = h;
             sym->sb_is_cdef = TRUE;
-            SYM_TREE_RB_INSERT(&s->ai_symbols, sym);
+            sym->sb_var     = NULL;
+            *slot = sym;
+            st->st_count++;
             /* The caller has to know, that this is a new symbol */
             sym->sb_name    = NULL;
         }
@@ -188,10 +262,20 @@ akl_new_symbol(struct akl_state *s, char *name, bool_t is_cname)
 struct akl_symbol *
 akl_get_symbol(struct akl_state *s, char *name)
 {
-    struct akl_symbol sym, *sptr;
-    sym.sb_name = name;
-    sptr = SYM_TREE_RB_FIND(&s->ai_symbols, &sym);
-    return sptr;
+    return *find_symbol_slot(&s->ai_symbols, name, akl_hash_name(name));
+}
+
+/* Iterate through the symbol table: Give back the next symbol
+   from the '*it' position (which must be 0 at the first call) */
+struct akl_symbol *
+akl_next_symbol(struct akl_state *s, unsigned int *it)
+{
+    struct akl_symbol_table *st = &s->ai_symbols;
+    while (*it < st->st_size) {
+        if (st->st_slots[(*it)++] != NULL)
+            return st->st_slots[*it - 1];
+    }
+    return NULL;
 }
 
 /* Only copies the string, when a new symbol is created */
@@ -215,6 +299,7 @@ akl_new_var(struct akl_state *s, struct akl_symbol *sym)
     var->vr_symbol = sym;
     var->vr_desc   = NULL;
     var->vr_value  = NULL;
+    var->vr_version = 0;
     return var;
 }
 
@@ -270,6 +355,16 @@ struct akl_value *akl_new_string_value(struct akl_state *in, char *str)
 }
 
 struct akl_value *akl_new_number_value(struct akl_state *in, double num)
+{
+#ifdef AKL_IMMEDIATE_NUMBERS
+    struct akl_value *val = akl_number_to_immediate(num);
+    if (val != NULL)
+        return val;
+#endif
+    return akl_new_boxed_number_value(in, num);
+}
+
+struct akl_value *akl_new_boxed_number_value(struct akl_state *in, double num)
 {
     struct akl_value *val = akl_new_value(in);
     val->va_type = AKL_VT_NUMBER;
@@ -307,6 +402,7 @@ struct akl_value *akl_new_user_value(struct akl_state *s, unsigned int type, voi
     /* We should stop now, since the requested type does not exist */
     assert(akl_vector_at(&s->ai_utypes, type));
     udata = (struct akl_userdata *)akl_gc_malloc(s, AKL_GC_UDATA);
+    AKL_GC_INIT_OBJ(udata, AKL_GC_UDATA);
     value = akl_new_value(s);
     udata->ud_id = type;
     udata->ud_private = data;
@@ -359,10 +455,37 @@ akl_new_function(struct akl_state *s /*, enum AKL_FUNCTION_TYPE ftype*/)
     f = (struct akl_function *)akl_gc_malloc(s, AKL_GC_FUNCTION);
     AKL_GC_INIT_OBJ(f, AKL_GC_FUNCTION);
 //    f->fn_type = ftype;
+    f->fn_is_pure = FALSE;
+    f->fn_captures = NULL;
     f->fn_body.cfun = NULL;
     return f;
 }
 
+/* The closure shares the code of the lambda, but has its own
+   copy of the captured values */
+struct akl_function *
+akl_new_closure(struct akl_state *s, struct akl_function *fn
+                , struct akl_value **values)
+{
+    struct akl_function *f = akl_new_function(s);
+    unsigned int n = akl_vector_count(&fn->fn_body.ufun.uf_captures);
+    f->fn_type = fn->fn_type;
+    f->fn_body = fn->fn_body;
+    f->fn_captures = (struct akl_value **)akl_calloc(s, n, sizeof(struct akl_value *));
+    memcpy(f->fn_captures, values, n * sizeof(struct akl_value *));
+    return f;
+}
+
+void
+akl_init_lisp_fun(struct akl_state *s, struct akl_lisp_fun *ufun)
+{
+    memset(ufun, 0, sizeof(struct akl_lisp_fun));
+    akl_init_vector(s, &ufun->uf_body, 0, sizeof(struct akl_ir_instruction));
+    akl_init_vector(s, &ufun->uf_locals, 0, sizeof(struct akl_symbol *));
+    akl_init_vector(s, &ufun->uf_captures, 0, sizeof(struct akl_capture));
+    akl_init_list(&ufun->uf_labels);
+}
+
 struct akl_value *
 akl_new_function_value(struct akl_state *s, struct akl_function *f)
 {
@@ -380,8 +503,7 @@ akl_new_label(struct akl_context *ctx)
 
 void akl_init_label(struct akl_label *l, int ind)
 {
-    l->la_ir     = NULL;
-    l->la_branch = NULL;
+    l->la_branch = 0;
     l->la_name   = NULL;
     l->la_ind    = ind;
 }
@@ -507,14 +629,14 @@ akl_reset_file_interpreter(struct akl_state *in, const char *name, FILE *fp)
 bool_t akl_var_is_function(struct akl_variable *var)
 {
     struct akl_value *v = (var != NULL) ? var->vr_value: NULL;
-    return (v != NULL) && (v->va_type == AKL_VT_FUNCTION);
+    return AKL_CHECK_TYPE(v, AKL_VT_FUNCTION);
 }
 
 struct akl_function *
 akl_var_to_function(struct akl_variable *var)
 {
     struct akl_value *v = (var != NULL) ? var->vr_value: NULL;
-    if ((v != NULL) && (v->va_type == AKL_VT_FUNCTION))
+    if (AKL_CHECK_TYPE(v, AKL_VT_FUNCTION))
         return v->va_value.func;
     return NULL;
 }
@@ -525,7 +647,7 @@ struct akl_value *akl_to_number(struct akl_state *in, struct akl_value *v)
 {
     char *str = NULL;
     if (v) {
-        switch (v->va_type) {
+        switch (AKL_TYPE(v)) {
             case AKL_VT_STRING:
             str = AKL_GET_STRING_VALUE(v);
             break;
@@ -571,7 +693,7 @@ struct akl_value *akl_to_string(struct akl_state *in, struct akl_value *v)
 {
     const char *str;
     if (v) {
-        switch (v->va_type) {
+        switch (AKL_TYPE(v)) {
             case AKL_VT_NUMBER:
             str = akl_num_to_str(in, AKL_GET_NUMBER_VALUE(v));
             break;
@@ -607,7 +729,7 @@ struct akl_value *akl_to_symbol(struct akl_state *in, struct akl_value *v)
     struct akl_value *val;
     char *name = NULL;
     if (v) {
-        switch (v->va_type) {
+        switch (AKL_TYPE(v)) {
             case AKL_VT_NUMBER:
             name = akl_num_to_str(in, AKL_GET_NUMBER_VALUE(v));
             break;
@@ -20,25 +20,47 @@
  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
  * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  ************************************************************************/
+#include <stddef.h>
 #include "aklisp.h"
 
-RB_GENERATE(SYM_TREE, akl_symbol, sb_entry, akl_rb_cmp_sym);
 RB_GENERATE(VAR_TREE, akl_variable, vr_entry, akl_rb_cmp_var);
 
-static struct akl_variable *
-set_global(struct akl_state *s, char *desc, bool_t is_cdesc
-           , struct akl_value *v, struct akl_variable *var)
+/**
+ * @brief Get the global binding slot of a symbol
+ * @param s Current interpreter state
+ * @param sym An interned symbol
+ * @return The slot of the symbol (created, if needed)
+ *
+ * The slot stays unbound (vr_value is NULL) and it is not
+ * in the variable tree, until the first assignment.
+ */
+struct akl_variable *
+akl_get_var_slot(struct akl_state *s, struct akl_symbol *sym)
 {
-    struct akl_variable *ovar;
-    if (var == NULL) {
-        return NULL;
+    AKL_ASSERT(s && sym, NULL);
+    if (sym->sb_var == NULL) {
+        sym->sb_var = akl_new_var(s, sym);
     }
-    ovar = VAR_TREE_RB_FIND(&s->ai_global_vars, var);
-    if (ovar != NULL) {
-        var = ovar;
-    } else {
+    return sym->sb_var;
+}
+
+/**
+ * @brief Bind a value to a global variable slot
+ * @see akl_get_var_slot
+ */
+struct akl_variable *
+akl_bind_var(struct akl_state *s, struct akl_variable *var
+            , char *desc, bool_t is_cdesc, struct akl_value *v)
+{
+    AKL_ASSERT(s && var && v, NULL);
+    if (var->vr_value == NULL) {
+        /* The variable tree is only used for the enumeration */
         VAR_TREE_RB_INSERT(&s->ai_global_vars, var);
+    } else {
+        /* Invalidate the inline caches */
+        var->vr_version++;
     }
+    AKL_GC_WRITE_BARRIER(s, var);
     var->vr_value    = v;
     var->vr_desc     = desc;
     var->vr_is_cdesc = is_cdesc;
@@ -52,7 +74,7 @@ akl_set_global_var(struct akl_state *s, struct akl_symbol *sym
                         , struct akl_value *v)
 {
     AKL_ASSERT(s && sym && v, NULL);
-    return set_global(s, desc, is_cdesc, v, akl_new_var(s, sym));
+    return akl_bind_var(s, akl_get_var_slot(s, sym), desc, is_cdesc, v);
 }
 
 struct akl_variable *
@@ -62,10 +84,8 @@ akl_set_global_variable(struct akl_state *s
                         , struct akl_value *v)
 {
     AKL_ASSERT(s && v, NULL);
-    struct akl_variable *var;
-    var = set_global(s, desc, is_cdesc, v
-                      , akl_new_variable(s, name, is_cname));
-    return var;
+    return akl_set_global_var(s, akl_new_symbol(s, name, is_cname)
+                              , desc, is_cdesc, v);
 }
 
 void
@@ -89,7 +109,7 @@ akl_add_global_function(struct akl_state *s, const char *name, const char *desc)
     return f;
 }
 
-void
+struct akl_function *
 akl_add_global_cfun(struct akl_state *s, akl_cfun_t fn
     , const char *name, const char *desc)
 {
@@ -97,6 +117,7 @@ akl_add_global_cfun(struct akl_state *s, akl_cfun_t fn
     assert(fun);
     fun->fn_type = AKL_FUNC_CFUN;
     fun->fn_body.cfun = fn;
+    return fun;
 }
 
 void
@@ -118,9 +139,10 @@ akl_add_global_sfun(struct akl_state *s, akl_sfun_t fn
 struct akl_variable *
 akl_get_global_var(struct akl_state *s, struct akl_symbol *sym)
 {
-    struct akl_variable var;
-    var.vr_symbol = sym;
-    return VAR_TREE_RB_FIND(&s->ai_global_vars, &var);
+    struct akl_variable *var;
+    AKL_ASSERT(sym, NULL);
+    var = sym->sb_var;
+    return (var != NULL && var->vr_value != NULL) ? var : NULL;
 }
 
 /**
@@ -132,10 +154,10 @@ akl_get_global_var(struct akl_state *s, struct akl_symbol *sym)
 struct akl_variable *
 akl_get_global_variable(struct akl_state *s, char *name)
 {
-    struct akl_symbol sym;
+    struct akl_symbol *sym;
     AKL_ASSERT(name, NULL);
-    sym.sb_name = name;
-    return akl_get_global_var(s, &sym);
+    sym = akl_get_symbol(s, name);
+    return (sym != NULL) ? akl_get_global_var(s, sym) : NULL;
 }
 
 struct akl_value *
@@ -158,7 +180,8 @@ void
 akl_do_on_all_syms(struct akl_state *s, void (*fn)(struct akl_symbol *))
 {
     struct akl_symbol *sym;
-    RB_FOREACH(sym, SYM_TREE, &s->ai_symbols) {
+    unsigned int it = 0;
+    while ((sym = akl_next_symbol(s, &it)) != NULL) {
        fn(sym);
     }
 }
@@ -166,11 +189,13 @@ akl_do_on_all_syms(struct akl_state *s, void (*fn)(struct akl_symbol *))
 void
 akl_declare_functions(struct akl_state *s, const struct akl_fun_decl *funs)
 {
+    struct akl_function *fun;
     assert(s && funs);
     while (funs->fd_fun.cfun && funs->fd_name) {
         switch (funs->fd_type) {
             case AKL_FUNC_CFUN:
-            akl_add_global_cfun(s, funs->fd_fun.cfun, funs->fd_name, funs->fd_desc);
+            fun = akl_add_global_cfun(s, funs->fd_fun.cfun, funs->fd_name, funs->fd_desc);
+            fun->fn_is_pure = funs->fd_is_pure;
             break;
 
             case AKL_FUNC_SPECIAL:
@@ -206,11 +231,34 @@ static const struct akl_feature {
     { "use-colors",  AKL_CFG_USE_COLORS,  "Use colorful prompt"       },
     { "interactive", AKL_CFG_INTERACTIVE, "Enable interactive prompt" },
     { "use-gc",      AKL_CFG_USE_GC,      "Enable Garbage Collector"  },
+    { "gen-gc",      AKL_CFG_GEN_GC,      "Generational collection"   },
+    { "incremental-gc", AKL_CFG_INCR_GC,  "Full collections in small slices" },
     { "debug-instr", AKL_DEBUG_INSTR,     "Debug instructions"        },
-    { "debug-stack", AKL_DEBUG_STACK,     "Debug stack"               }
+    { "debug-stack", AKL_DEBUG_STACK,     "Debug stack"               },
+    { "optimize",    AKL_CFG_OPTIMIZE,    "Optimize the compiled code" },
+    { "lazy-compile", AKL_CFG_LAZY_COMPILE, "Compile the functions at their first call" }
 };
 
 #define FEATURE_COUNT sizeof(akl_features)/sizeof(akl_features[0])
+
+/* Numeric options, they are given as 'name=value' */
+static const struct akl_setting {
+    const char  *as_name;
+    size_t       as_offset; /* Offset of the unsigned long field in the state */
+    const char  *as_desc;
+} akl_settings[] = {
+    { "gc-threshold", offsetof(struct akl_state, ai_gc_threshold)
+                    , "Allocated bytes between two collections" },
+    { "gc-major-threshold", offsetof(struct akl_state, ai_gc_major_threshold)
+                    , "Promoted bytes between two full collections" },
+    { "gc-slice-objects", offsetof(struct akl_state, ai_gc_slice_objects)
+                    , "Objects scanned in a slice of incremental-gc (0: no limit)" },
+    { "gc-slice-usecs", offsetof(struct akl_state, ai_gc_slice_usecs)
+                    , "Microseconds of a slice of incremental-gc (0: no limit)" }
+};
+
+#define SETTING_COUNT sizeof(akl_settings)/sizeof(akl_settings[0])
+#define SETTING_AT(s, i) (*(unsigned long *)((char *)(s) + akl_settings[i].as_offset))
 void show_features(struct akl_state *s, const char *fname) 
 {
     int i;
@@ -226,6 +274,11 @@ void show_features(struct akl_state *s, const char *fname)
                                     , AKL_IS_FEATURE_ON(s, akl_features[i].af_bit) ? (AKL_GREEN "[on]") : (AKL_RED "[off]")
                                     , AKL_END_COLOR_MARK);
         }
+        for (i = 0; i < SETTING_COUNT; i++) {
+            printf("\t%s:%-10s%s\t%-30s%s[%lu]%s\n", AKL_YELLOW, akl_settings[i].as_name, AKL_END_COLOR_MARK
+                                    , akl_settings[i].as_desc, AKL_GREEN, SETTING_AT(s, i)
+                                    , AKL_END_COLOR_MARK);
+        }
         printf("\nUsage:\n\tEnable: (%s%s%s %s:use-colors%s)\n"
                "\tDisable: (%s%s%s %s:no-use-colors%s)\n"
                     , AKL_PURPLE, fname, AKL_END_COLOR_MARK, AKL_YELLOW, AKL_END_COLOR_MARK
@@ -236,6 +289,10 @@ void show_features(struct akl_state *s, const char *fname)
             printf("\t:%-10s\t%-30s%-10s\n", akl_features[i].af_name, akl_features[i].af_desc
                                     , AKL_IS_FEATURE_ON(s, akl_features[i].af_bit) ? "[on]" : "[off]");
         }
+        for (i = 0; i < SETTING_COUNT; i++) {
+            printf("\t:%-10s\t%-30s[%lu]\n", akl_settings[i].as_name, akl_settings[i].as_desc
+                                    , SETTING_AT(s, i));
+        }
         printf("\nUsage:\n\tEnable: (%s :use-colors)\n"
                "\tDisable: (%s :no-use-colors)\n", fname, fname);
     }
@@ -259,12 +316,33 @@ bool_t akl_set_feature_to(struct akl_state *s, const char *feature, bool_t to)
    return FALSE;
 }
 
+bool_t akl_set_setting(struct akl_state *s, const char *name, unsigned long value)
+{
+   int i;
+   if (!s || !name)
+       return FALSE;
+
+   for (i = 0; i < SETTING_COUNT; i++) {
+       if (strcmp(akl_settings[i].as_name, name) == 0) {
+           SETTING_AT(s, i) = value;
+           return TRUE;
+       }
+   }
+   return FALSE;
+}
+
 bool_t akl_set_feature(struct akl_state *s, const char *feature)
 {
    bool_t to = TRUE;
+   char name[64];
+   unsigned long value;
    if (!feature)
        return FALSE;
 
+   /* A numeric setting (name=value) */
+   if (sscanf(feature, "%63[^=]=%lu", name, &value) == 2)
+       return akl_set_setting(s, name, value);
+
    if (strncmp(feature, "no-", 3) == 0) {
        to = FALSE;
        feature += 3;          // discard no-
@@ -0,0 +1,7 @@
+; List churn: Most of the allocated lists die young, so the
+; minor collections have nearly nothing to promote. Run with
+; '-C use-gc', the GC statistics are printed at the end.
+(defun! churn (n) (dotimes (i n) (list i i i (list i i))))
+
+(churn 1000000)
+(about)
@@ -0,0 +1,51 @@
+/* GC allocation benchmark: 10M allocate/free cycles without gen-gc.
+   Every other object of the live set is kept, so the free slots are
+   scattered over all the pools, then the freed half is allocated
+   again and swept, until 10M objects are allocated. */
+#include <aklisp.h>
+#include <time.h>
+
+#define NR_ALLOCS  10000000
+#define NR_LIVE    262144
+
+static struct akl_state state;
+
+static double elapsed(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec)
+         + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main()
+{
+    struct akl_value *v;
+    struct timespec start;
+    long i, n = 0;
+
+    akl_init_state(&state, NULL);
+    AKL_UNSET_FEATURE(&state, AKL_CFG_GEN_GC);
+    akl_gc_enable(&state);
+    /* The objects of the interpreter are kept */
+    akl_gc_mark(&state);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < NR_LIVE; i++) {
+        v = akl_new_boxed_number_value(&state, i);
+        if (i % 2 == 0)
+            AKL_GC_SET_MARK(v, TRUE);
+    }
+    n += NR_LIVE;
+    while (n < NR_ALLOCS) {
+        akl_gc_sweep(&state);
+        for (i = 0; i < NR_LIVE/2; i++)
+            akl_new_boxed_number_value(&state, i);
+        n += NR_LIVE/2;
+    }
+    akl_gc_sweep(&state);
+    printf("%-40s %10.3f\n", "allocate/free (10M, scattered)", elapsed(&start));
+    printf("%-40s %10u\n", "value pools"
+           , akl_gc_get_type(&state, AKL_GC_VALUE)->gt_pool_count);
+    return 0;
+}
@@ -0,0 +1,17 @@
+#!/bin/bash
+# Print a generated library for the startup benchmark of lazy-compile:
+# N functions (2000 by default, 5 lines each, about 10k lines), then
+# a call of one of them, so only that body is needed.
+# Usage: ./gen_lib.sh [N] > lib.lsp
+
+N=${1:-2000}
+for ((i = 0; i < N; i++)) ; do
+    cat <<LSP
+(defun! f$i (a b)
+  "Function number $i"
+  (let ((x (+ a $i)) (y (* b 2)))
+    (cond ((< x y) (f$i (- x 1) y)) ((> x 100) (list x y a b)) (t (+ x y)))))
+
+LSP
+done
+echo "(display (f7 1 2))"
@@ -0,0 +1,12 @@
+; Live heap: 300k small lists are kept while 2M lists die young,
+; so the full collections have a big heap to mark. Run with
+; '-C use-gc' (and '-C incremental-gc' for the sliced collections),
+; the GC statistics are printed at the end.
+(set! keep nil)
+(defun! build (n) (dotimes (i n) (set! keep (insert! (list i i) keep))))
+(defun! churn (n) (dotimes (i n) (list i i i (list i i))))
+
+(build 300000)
+(churn 2000000)
+(print (length keep))
+(about)
@@ -0,0 +1,124 @@
+#!/bin/bash
+# Measure the interpreter on examples/fib.lsp, examples/while.lsp,
+# churn.lsp and heap.lsp (with the GC turned on), print the pauses of
+# the collections (heap.lsp also with incremental-gc) and the peak
+# memory, the startup on a generated 10k-line library (see gen_lib.sh)
+# with and without lazy-compile, then run the built C benchmarks
+# (*.bench, see the Makefile).
+# Usage: ./run_bench.sh [aklisp binaries...]
+#
+# To see the difference between the dispatch modes, build the
+# interpreter twice (with -DUSE_THREADED_CODE=ON and OFF) and give
+# both binaries as arguments.
+
+cd "$(dirname "$0")"
+bench_dir=$(pwd)
+bins=("$@")
+if [ ${#bins[@]} -eq 0 ] ; then
+    bins=(../../aklisp)
+fi
+
+FIB_N=${FIB_N:-22}
+RUNS=${RUNS:-3}
+TIMEFORMAT=%R
+
+# Prints the best wall clock time (in seconds) of $RUNS runs
+best_of() {
+    local best="" t
+    for ((r = 0; r < RUNS; r++)) ; do
+        t=$( { time "$@" >/dev/null 2>&1 ; } 2>&1 )
+        if [ -z "$best" ] || awk "BEGIN { exit !($t < $best) }" ; then
+            best=$t
+        fi
+    done
+    echo $best
+}
+
+bench_fib() {
+    (cd ../../examples && echo $FIB_N | "$1" -C no-use-colors fib.lsp)
+}
+
+bench_while() {
+    "$1" -C no-use-colors "$bench_dir/while.lsp"
+}
+
+bench_churn() {
+    "$1" -C no-use-colors -C use-gc "$bench_dir/churn.lsp"
+}
+
+bench_heap() {
+    "$1" -C no-use-colors -C use-gc "${@:2}" "$bench_dir/heap.lsp"
+}
+
+bench_startup() {
+    "$1" -C no-use-colors "${@:2}" "$lib"
+}
+
+# Prints the peak resident memory of the binary run with the given
+# arguments, the high water mark is read until the process exits
+peak_rss() {
+    local pid hwm="" m
+    if [ ! -d /proc/self ] ; then
+        echo "n/a"
+        return
+    fi
+    "$@" >/dev/null 2>&1 &
+    pid=$!
+    while m=$(awk '/VmHWM/ { print $2 }' /proc/$pid/status 2>/dev/null) \
+            && [ -n "$m" ] ; do
+        hwm=$m
+        sleep 0.01
+    done
+    wait $pid
+    echo "${hwm:-n/a} kB"
+}
+
+printf "%-40s %10s %10s %10s %10s\n" "binary" "fib($FIB_N)" "while" "churn" "heap"
+for b in ${bins[@]} ; do
+    b=$(cd "$(dirname "$b")" && pwd)/$(basename "$b")
+    if [ ! -x "$b" ] ; then
+        echo "$b: not found"
+        exit 1
+    fi
+    printf "%-40s %10s %10s %10s %10s\n" "$b" "$(best_of bench_fib $b)" "$(best_of bench_while $b)" \
+           "$(best_of bench_churn $b)" "$(best_of bench_heap $b)"
+done
+
+echo ""
+echo "GC on churn.lsp:"
+for b in ${bins[@]} ; do
+    echo "$b:"
+    bench_churn "$b" | grep -E "collections|pauses"
+    echo "	peak memory: $(peak_rss "$b" -C use-gc "$bench_dir/churn.lsp")"
+done
+
+echo ""
+echo "GC on heap.lsp (stop-the-world, then incremental-gc):"
+for b in ${bins[@]} ; do
+    echo "$b:"
+    bench_heap "$b" | grep -E "collections|pauses|slices"
+    echo "	peak memory: $(peak_rss "$b" -C use-gc "$bench_dir/heap.lsp")"
+    bench_heap "$b" -C incremental-gc | grep -E "collections|pauses|slices"
+    echo "	peak memory: $(peak_rss "$b" -C use-gc -C incremental-gc "$bench_dir/heap.lsp")"
+done
+
+echo ""
+echo "Startup on a 10k-line library (2000 functions, one called):"
+lib=$(mktemp "${TMPDIR:-/tmp}/akl_lib.XXXXXX")
+./gen_lib.sh > "$lib"
+printf "%-40s %10s %10s\n" "binary" "eager" "lazy"
+for b in ${bins[@]} ; do
+    printf "%-40s %10s %10s\n" "$b" "$(best_of bench_startup $b)" \
+           "$(best_of bench_startup $b -C lazy-compile)"
+done
+rm -f "$lib"
+
+benches=(*.bench)
+if [ -e "${benches[0]}" ] ; then
+    export LD_LIBRARY_PATH=../..:$LD_LIBRARY_PATH
+    for t in ${benches[@]} ; do
+        echo ""
+        echo "$t:"
+        ./$t || exit 1
+    done
+fi
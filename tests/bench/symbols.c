@@ -0,0 +1,45 @@
+/* Symbol interning benchmark: Interns 1M symbols, half of them
+   are new, the other half are repeated (with different case). */
+#include <aklisp.h>
+#include <time.h>
+
+#define NR_SYMBOLS 1000000
+
+static struct akl_state state;
+
+static double elapsed(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec)
+         + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main()
+{
+    static struct akl_symbol *syms[NR_SYMBOLS/2];
+    struct akl_symbol *sym;
+    struct timespec start;
+    char name[32];
+    int i;
+
+    akl_init_state(&state, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < NR_SYMBOLS/2; i++) {
+        snprintf(name, sizeof(name), "symbol-%d", i);
+        syms[i] = akl_get_or_create_symbol(&state, name);
+    }
+    printf("%-40s %10.3f\n", "intern (distinct)", elapsed(&start));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < NR_SYMBOLS/2; i++) {
+        snprintf(name, sizeof(name), "SYMBOL-%d", i);
+        sym = akl_get_or_create_symbol(&state, name);
+        if (sym != syms[i]) {
+            fprintf(stderr, "symbols: '%s' is interned twice\n", name);
+            return 1;
+        }
+    }
+    printf("%-40s %10.3f\n", "intern (repeated)", elapsed(&start));
+    return 0;
+}
@@ -0,0 +1,11 @@
+; The loop of examples/while.lsp, without the printing and with
+; much more iterations, so the dispatch overhead can be measured.
+(defun! count-n (n) ($
+        (set! i 0)
+        (while (< i n)
+               (set! i (++ i))
+        )
+    )
+)
+
+(count-n 50000)
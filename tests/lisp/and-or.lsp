@@ -0,0 +1,10 @@
+; and/or give the deciding value, the rest is not evaluated
+(set! hits 0)
+(defun! hit (v) ($ (set! hits (++ hits)) v))
+(print (and 1 2 3))
+(print (and 1 nil (hit 3)))
+(print (or nil 2 (hit 3)))
+(print (or nil nil))
+(print (and))
+(print (or))
+(print hits)
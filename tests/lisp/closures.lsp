@@ -0,0 +1,20 @@
+; Closures capture the values of the enclosing function
+(defun! adder (n) (lambda (x) (+ x n)))
+(set! add5 (adder 5))
+(set! add9 (adder 9))
+(print (map (list 1 2 3) add5))
+(print (map (list 1 2 3) add9))
+(defun! scaled (k l) (map l (lambda (x) (* x k))))
+(print (scaled 3 (list 1 2 3)))
+(defun! nested (a) (lambda (b) (lambda (c) (list a b c))))
+(set! with-b (car (map (list 2) (nested 1))))
+(print (map (list 3 4) with-b))
+; The captured list is shared, its changes are seen by the closure
+(defun! collector (l) (lambda (x) (append! x l)))
+(set! items (list 0))
+(set! collect (collector items))
+(map (list 1 2) collect)
+(print items)
+; The captured variables are copies, they cannot be set
+(defun! make-acc (start) (let ((sum start)) (lambda (x) (set! sum (+ sum x)))))
+(print sum)
@@ -0,0 +1,17 @@
+; cond: The first true test gives the value
+(defun! sign (n) (cond ((< n 0) 'neg) ((= n 0) 'zero) (t 'pos)))
+(print (map (list -5 0 7) sign))
+(print (cond (nil 1)))
+; case: Dense numbers (index table), lists of keys and the default
+(defun! small (n) (case n (0 "zero") (1 "one") ((2 3) "few") (else "many")))
+(print (map (list 0 1 2 3 4 -1 100) small))
+; Sparse numbers and symbols (hash), without a default the value is nil
+(defun! sparse (n) (case n (10 'ten) (1000 'thousand) (-7 'minus-seven)))
+(print (map (list 10 1000 -7 11) sparse))
+(defun! color (c) (case c (red 1) ((green lime) 2) (blue 3) (otherwise 0)))
+(print (map (list 'red 'green 'lime 'blue 'black) color))
+; Non-key values fall through to the default
+(print (map (list "red" 1.5 nil) color))
+; The first clause of a duplicate key wins
+(defun! dup (n) (case n (1 'first) (1 'second) ((2 1) 'third) (t 'other)))
+(print (map (list 1 2 3) dup))
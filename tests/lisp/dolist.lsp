@@ -0,0 +1,16 @@
+; dolist walks the entries of the list
+(dolist (x (list 1 "two" 'three)) (print x))
+(print (dolist (x (list 1 2)) x))
+; Empty lists and nil are not iterated
+(dolist (x (list)) (print x))
+(dolist (x nil) (print x))
+(defun! count-items (l) (let ((n 0)) ($ (dolist (x l) (set! n (++ n))) n)))
+(print (map (list (list) (list 1) (list 1 2 3)) count-items))
+; Sublists share the entries of the list
+(set! l (list 1 2 3 4))
+(dolist (x (cdr (cdr l))) (print x))
+; Nested loops
+(defun! pairs (n) (let ((r (list))) ($ (dotimes (i n) (dolist (x (list 'a 'b)) (append! (list i x) r))) r)))
+(print (pairs 2))
+(for-each (x (list 7)) (print x))
+(dolist (x 5) (print x))
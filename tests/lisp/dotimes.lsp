@@ -0,0 +1,7 @@
+; The limit of dotimes is checked once, before the loop
+(dotimes (i 3) (print i))
+(dotimes (i 'a) (print i))
+(defun! count-to (n) (dotimes (i n) (display i)))
+(count-to "x")
+(count-to 2)
+(print (dotimes (i 0) (print i)))
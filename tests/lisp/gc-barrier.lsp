@@ -0,0 +1,17 @@
+; New entries linked from old objects must survive the minor collections
+(set! big (list 1 2 3))
+(defun! churn (n) (dotimes (i n) (list i i i (list i i))))
+(churn 3000)
+; The header of the sublist is young, but its last entry is old
+(defun! append-to-tail () (append! (list 7 8 9) (cdr big)))
+(length (append-to-tail))
+(churn 3000)
+(print big)
+; Appending to (and inserting into) an old list
+(set! old (list "a" "b"))
+(churn 3000)
+(defun! grow (n) (dotimes (i n) (append! (list i "x") old)))
+(grow 3)
+(insert! (list "head") old)
+(churn 3000)
+(print old)
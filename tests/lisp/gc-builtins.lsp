@@ -0,0 +1,7 @@
+; The builtins calling lisp functions must keep their results
+; (the collections run in the called functions too)
+(load "./include/churn.lsp")
+(defun! work (x) ($ (churn 200) (list x x)))
+(print (map (list 1 2 3 4 5 6) work))
+(print (times-index 5 (lambda (i) ($ (churn 300) (list i "t")))))
+(print (foldl (list) (list 1 2 3 4) (lambda (acc x) ($ (churn 300) (append! (list x) acc)))))
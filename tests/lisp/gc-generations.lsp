@@ -0,0 +1,25 @@
+; The reachable objects survive the minor and the major collections
+(defun! churn (n) (dotimes (i n) (list i i i (list i i))))
+; Young objects in a global, promoted by the minor collections
+(set! g (list "str" 1.5 'sym (list 1 2)))
+(churn 3000)
+(print g)
+; Locals and arguments of a running function
+(defun! hold (a) (let ((b (list a a))) ($ (churn 3000) (list a b))))
+(print (hold (list "arg")))
+; A list built between collections (old entries link young ones)
+(defun! build (n) (let ((r (list))) ($ (dotimes (i n) ($ (churn 20) (append! (list i) r))) r)))
+(set! built (build 300))
+(churn 6000)
+(print (length built))
+(print (foldl 0 built (lambda (a e) (+ a (car e)))))
+; The captured values of the closures
+(defun! keeper (v) (lambda () v))
+(set! k (keeper (list "kept" (list 1 2 3))))
+(churn 6000)
+(print (k))
+; Unreachable objects are freed, the rest is still correct
+(set! g nil)
+(churn 6000)
+(print (length built))
+(print (car (cdr (k))))
@@ -0,0 +1,3 @@
+; Loaded by the tests, it is also a collection under a builtin (load)
+(defun! churn (n) (dotimes (i n) (list i i i (list i i))))
+(churn 3000)
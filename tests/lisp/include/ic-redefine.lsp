@@ -0,0 +1,2 @@
+; Loaded at run time, so g is redefined after f was called
+(defun! g (x) (- x 1))
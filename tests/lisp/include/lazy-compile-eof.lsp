@@ -0,0 +1,3 @@
+; The body is not closed
+(defun! unclosed (x)
+  ($ (print x)
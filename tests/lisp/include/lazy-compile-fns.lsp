@@ -0,0 +1,6 @@
+; The bodies are compiled at the first call
+(defun! twice (x) (* x 2))
+
+(defun! bad-body (x)
+  ($ (set-const! y 1)
+     (+ x 1)))
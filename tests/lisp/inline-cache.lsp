@@ -0,0 +1,17 @@
+; The inline cache of a call is dropped, when its callee is rebound
+(defun! g (x) (+ x 1))
+(defun! f (x) (g x))
+(ic-stats)
+(print (f 1))
+(print (f 1))
+(ic-stats)
+; set! of the callee: The next call misses and takes the new function
+(set! g (lambda (x) (* x 100)))
+(print (f 2))
+(print (f 2))
+(ic-stats)
+; defun! at run time (in a loaded file)
+(load "./include/ic-redefine.lsp")
+(print (f 2))
+(print (f 3))
+(ic-stats)
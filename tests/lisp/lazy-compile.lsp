@@ -0,0 +1,9 @@
+; The functions of the loaded files are compiled lazily
+(akl-cfg! :lazy-compile)
+(load "./include/lazy-compile-fns.lsp")
+(print (twice 21))
+(print (twice 4))
+; The errors of a body are reported at the first call, at their place
+(print (bad-body 1))
+; The end of the file in a body is reported at the defun!
+(load "./include/lazy-compile-eof.lsp")
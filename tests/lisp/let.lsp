@@ -0,0 +1,13 @@
+; let: The values are computed before the binding
+(set! x 1)
+(print (let ((x 10) (y x)) (list x y)))
+(print (let* ((x 10) (y x)) (list x y)))
+(print x)
+; Inner let shadows the outer one and the arguments
+(defun! shadow (a) (let ((a (+ a 1))) (list a (let ((a (* a 10))) a) a)))
+(print (shadow 1))
+; set! on a local changes only the innermost binding
+(defun! counter (n) (let ((i 0)) ($ (dotimes (k n) (set! i (+ i k))) i)))
+(print (counter 5))
+(defun! inner-set (a) (let ((b a)) ($ (let ((b 100)) (set! b 200)) (list a b))))
+(print (inner-set 7))
@@ -0,0 +1,7 @@
+; A too deep call is an error, and it gives no result: The call
+; under map gives NIL, the one at the top level stops the program
+(defun! deep (n) (if (= n 0) 0 (+ 1 (deep (- n 1)))))
+(print (deep 100))
+(print (map '(1 10000 2) (lambda (x) (deep x))))
+(print (deep 10000))
+(print 'not-reached)
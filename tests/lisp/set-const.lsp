@@ -0,0 +1,12 @@
+; Constants are bound at compile time, only at the top level
+(set-const! pi 3.14)
+(set-const! pi 3.14)
+(set-const! pi 3)
+(print pi)
+(if nil (set-const! never 1) 0)
+(defun! f () (set-const! inner 2))
+(set-const! name "x")
+(set-const! name "x")
+(print name)
+(set! pi 4)
+(print (+ pi 1))
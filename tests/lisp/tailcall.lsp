@@ -0,0 +1,18 @@
+; Calls in tail position reuse the frame, so they can go much deeper
+; than the call stack (4096 nested calls)
+(defun! tl (n) (if (= n 0) 'done (tl (- n 1))))
+(print (tl 1000000))
+; Mutual recursion
+(defun! even? (n) (if (= n 0) t (odd? (- n 1))))
+(defun! odd? (n) (if (= n 0) nil (even? (- n 1))))
+(print (list (even? 100001) (odd? 100001)))
+; A tail call from the body of let (the locals are made again)
+(defun! tl-let (n acc) (let ((m (- n 1)) (a (+ acc 1))) (if (= n 0) acc (tl-let m a))))
+(print (tl-let 100000 0))
+(defun! tl-let* (n acc) (let* ((m (- n 1)) (a (+ acc m))) (if (< m 0) acc (tl-let* m a))))
+(print (tl-let* 1000 0))
+; A tail call of a C function is a normal call
+(defun! tl-cfun (n) (if (= n 1) (list 'one n) (tl-cfun (- n 1))))
+(print (tl-cfun 50000))
+(defun! last-sum (l acc) (if (= (length l) 0) (+ acc 0) (last-sum (cdr l) (+ acc (car l)))))
+(print (last-sum (list 1 2 3 4) 0))
@@ -3,6 +3,7 @@
 export LD_LIBRARY_PATH=..:$LD_LIBRARY_PATH
 
 tests=(*.test)
+ret=0
 
 if [ ${#tests[@]} -eq 0 ] ; then
     echo "There are no tests built."
@@ -14,7 +15,6 @@ if [ ${#tests[@]} -eq 0 ] ; then
     fi
     exit 1
 else
-    ret=0
     for t in ${tests[@]} ; do
         ./$t
         if [ $? -eq 1 ] ; then
@@ -24,5 +24,30 @@ else
     done
 
     echo "${#tests[@]} tests completed."
-    exit $ret
 fi
+
+# The lisp tests: Every lisp/*.lsp is run by the interpreter (also
+# with the GC turned on, with small thresholds, so it really runs),
+# and its output must be the same as the lisp/*.out file. The tests
+# are run in the lisp directory, and the loaded files (with absolute
+# names) are reported relative to it.
+aklisp=${AKLISP:-$PWD/../aklisp}
+gc_modes=("" "-C use-gc -C gc-threshold=2048 -C gc-major-threshold=8192"
+          "-C use-gc -C gc-threshold=2048 -C incremental-gc -C gc-slice-objects=10")
+if [ -x "$aklisp" ] ; then
+    nr_lisp=0
+    for t in lisp/*.lsp ; do
+        for mode in "${gc_modes[@]}" ; do
+            if ! (cd lisp && $aklisp -C no-use-colors $mode ${t#lisp/} 2>&1) \
+                    | sed "s|$PWD/lisp/||" | diff -u ${t%.lsp}.out - ; then
+                echo "FAIL: $t ($mode)"
+                ret=1
+            fi
+        done
+        nr_lisp=$((nr_lisp+1))
+    done
+    echo "$nr_lisp lisp tests completed."
+else
+    echo "$aklisp is not built, the lisp tests are skipped."
+fi
+exit $ret